@@ -0,0 +1,45 @@
+/*
+ * ansi.h
+ * Declares the VT100/ANSI escape sequence parser used by the terminal
+ * write path
+ */
+
+#ifndef ANSI_H
+#define ANSI_H
+
+#include "types.h"
+
+#define ANSI_ESC            0x1B
+
+/* Parser states */
+#define ANSI_GROUND         0
+#define ANSI_ESCAPE         1
+#define ANSI_CSI            2
+#define ANSI_STATES         3
+
+/* Number of CSI parameters kept, extra ones overwrite the last */
+#define ANSI_MAX_PARAMS     4
+#define ANSI_PARAM_MAX      9999
+
+/* SGR parameters */
+#define SGR_RESET           0
+#define SGR_BOLD            1
+#define SGR_NORMAL          22
+#define SGR_FG_FIRST        30
+#define SGR_FG_LAST         37
+#define SGR_FG_DEFAULT      39
+#define SGR_BG_FIRST        40
+#define SGR_BG_LAST         47
+#define SGR_BG_DEFAULT      49
+
+#define ATTRIB_FG_MASK      0x0F
+#define ATTRIB_BG_MASK      0xF0
+#define ATTRIB_BRIGHT       0x08
+#define ATTRIB_BG_SHIFT     4
+
+struct terminal;
+
+/* Feeds one byte of an escape sequence to the terminal's parser */
+void ansi_putc(struct terminal * term, uint8_t c);
+
+#endif
@@ -14,6 +14,9 @@
 #define RELEASED_MASK        0x80
 
 #define MAX_BUFFER_SIZE      128
+/* per-terminal ring of typed characters, a power of two */
+#define KBD_RING_SIZE        512
+#define KBD_RING_MASK        (KBD_RING_SIZE - 1)
 #define SUPPORTED_KEYS       93
 #define OFFSET_TO_UPPERCASE  32
 
@@ -21,6 +24,8 @@
 #define CTRL_L               12
 #define CTRL_C               3
 #define CTRL_A               1
+#define CTRL_MASK            0x1F
+#define ASCII_BACKSPACE      8
 
 /* Definitions of all the keys */
 #define ENTER_KEYCODE        0x1C
@@ -52,6 +57,12 @@
 #define FUNCTION_1           0x3B
 #define FUNCTION_2           0x3C
 #define FUNCTION_3           0x3D
+#define FUNCTION_10          0x44
+#define FUNCTION_11          0x57
+#define FUNCTION_12          0x58
+
+#define PAGE_UP              0x49
+#define PAGE_DOWN            0x51
 
 #define BACKSPACE            0x0E
 
@@ -71,10 +82,14 @@ int keyboard_open(const uint8_t* filename);
 
 int keyboard_close(int32_t fd);
 
+void keyboard_end_line(void);
+
 /* local helper functions */
 int32_t check_modifier_keys(uint8_t scan1, uint8_t scan2);
 int32_t check_function_keys(uint8_t scan1);
+int32_t check_scroll_keys(uint8_t scan1);
 int32_t check_control_codes(uint8_t scan1);
+int32_t check_raw_mode(uint8_t scan1);
 void print_character(uint8_t scan1);
 
 #endif
@@ -47,4 +47,6 @@ int32_t rtc_open(const uint8_t* filename);
 
 int32_t rtc_close(int32_t fd);
 
+int32_t rtc_poll(int32_t fd, uint32_t ** wq);
+
 #endif /* RTC_H */
@@ -0,0 +1,78 @@
+/*
+ * serial.h
+ * Declares the interrupt-driven 16550 UART driver for COM1
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "types.h"
+#include "filesystem.h"
+
+#define SERIAL_IRQ            4
+#define COM1_PORT             0x3F8
+
+/* Register offsets from the base port */
+#define UART_DATA             0  // RBR/THR, divisor low with DLAB
+#define UART_IER              1  // interrupt enable, divisor high with DLAB
+#define UART_IIR              2  // interrupt identification (read)
+#define UART_FCR              2  // FIFO control (write)
+#define UART_LCR              3
+#define UART_MCR              4
+#define UART_LSR              5
+#define UART_MSR              6
+#define UART_SCRATCH          7
+
+#define UART_LCR_DLAB         0x80
+#define UART_LCR_8N1          0x03
+#define UART_DIVISOR          1     // 115200 baud
+/* enable and clear both FIFOs, interrupt at 14 received bytes */
+#define UART_FCR_SETUP        0xC7
+/* DTR, RTS and OUT2, which gates the IRQ line */
+#define UART_MCR_SETUP        0x0B
+#define UART_IER_RX           0x01
+#define UART_IER_TX           0x02
+#define UART_LSR_DATA         0x01
+
+#define UART_IIR_NONE         0x01
+#define UART_IIR_ID_MASK      0x0E
+#define UART_IIR_MSR          0x00
+#define UART_IIR_TX           0x02
+#define UART_IIR_RX           0x04
+#define UART_IIR_LSR          0x06
+#define UART_IIR_RX_TIMEOUT   0x0C
+
+#define UART_FIFO_SIZE        16
+#define UART_SCRATCH_TEST     0xAE
+
+/* Ring buffer sizes, powers of two */
+#define SERIAL_TX_SIZE        4096
+#define SERIAL_RX_SIZE        1024
+
+/* Terminal whose output is copied to COM1, -1 for none */
+#define SERIAL_MIRROR_TERM    0
+
+#define SERIAL_DEVICE_NAME    "serial"
+#define SERIAL_FILE_TYPE      3
+
+/* Externally visible functions */
+
+void serial_init(void);
+
+extern void serial_interrupt_handler(void);
+
+uint32_t serial_output(const uint8_t * buf, uint32_t nbytes);
+
+void serial_mirror(uint32_t term_num, const void * buf, int32_t nbytes);
+
+int32_t serial_read(int32_t fd, void* buf, int32_t nbytes);
+
+int32_t serial_write(int32_t fd, const void* buf, int32_t nbytes);
+
+int32_t serial_open(const uint8_t* filename);
+
+int32_t serial_close(int32_t fd);
+
+int32_t serial_poll(int32_t fd, uint32_t ** wq);
+
+#endif /* SERIAL_H */
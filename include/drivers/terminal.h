@@ -11,29 +11,95 @@
 #include "lib.h"
 #include "filesystem.h"
 #include "process.h"
+#include "paging.h"
 #include "drivers/keyboard.h"
+#include "drivers/ansi.h"
 
-#define MAX_TERMINALS  3
+/* terminals are created on demand, one for each of ALT-F1 to ALT-F12 */
+#define MAX_TERMINALS  12
 
 #define NUM_COLS       80
 #define NUM_ROWS       25
 
+/* A terminal's screen lives in one of the VGA slots of the 32KB of text
+   memory, used as a ring of rows that the screen scrolls through. Terminals
+   that lost their slot to a more recently shown one keep their screen in
+   their backup page instead, which only holds the screen itself. */
+#define TERM_VGA_SLOTS    3
+#define TERM_VIDMEM_SIZE  _8KB
+#define TERM_ROW_SIZE     (NUM_COLS * 2)
+#define TERM_VIDMEM_ROWS  (TERM_VIDMEM_SIZE / TERM_ROW_SIZE)
+
+/* first visible character of a terminal */
+#define TERM_SCREEN(term) ((term)->vidmem + (term)->top_row * TERM_ROW_SIZE)
+
+/* spare VGA memory after the slots, used to show scrollback history */
+#define TERM_VIEW_VIDMEM  (VIDEO_MEM_START + TERM_VGA_SLOTS * TERM_VIDMEM_SIZE)
+
+/* lines of history kept for each terminal, in pages of whole lines */
+#define SCROLLBACK_PAGES          10
+#define SCROLLBACK_LINES_PER_PAGE (_4KB / TERM_ROW_SIZE)
+#define SCROLLBACK_LINES          (SCROLLBACK_PAGES * SCROLLBACK_LINES_PER_PAGE)
+
+/* Memory of a terminal, in pages that need not be contiguous: the struct,
+   the screen backup (page aligned for vidmap), the scrollback, then the
+   off-screen buffers of vidmap_buffers */
+#define TERM_MEM_PAGES        (2 + SCROLLBACK_PAGES + NUM_VIDBUFS)
+
+/* a line of a terminal's scrollback ring */
+#define TERM_SB_LINE(term, n) \
+    ((term)->sb_pages[(n) / SCROLLBACK_LINES_PER_PAGE] \
+                     [(n) % SCROLLBACK_LINES_PER_PAGE])
+
+/* one of a terminal's off-screen buffers (identity mapped) */
+#define TERM_VIDBUF(term, i)  ((term)->vidbufs[i])
+
 #define STDIN          0
 #define STDOUT         1
 
 typedef struct terminal {
+    uint32_t num;
     uint32_t x_pos;
     uint32_t y_pos;
-    uint8_t * virt_vidmem_backup;
-    uint32_t phys_vidmem_backup;
+    /* the terminal's screen, in its VGA slot or its backup (identity
+       mapped) */
+    uint8_t * vidmem;
+    uint8_t * backup;
+    int32_t vga_slot;
+    uint32_t last_shown;
+    /* row of vidmem shown at the top of the screen */
+    uint32_t top_row;
+    uint8_t * vidbufs[NUM_VIDBUFS];
 
-    uint32_t buffer_size;
-    uint8_t buffer[MAX_BUFFER_SIZE];
+    /* ring of rows that scrolled off the top of the screen */
+    uint16_t (*sb_pages[SCROLLBACK_PAGES])[NUM_COLS];
+    uint32_t sb_size;
+    uint32_t sb_head;
+    uint32_t sb_count;
+
+    /* Typed characters. The keyboard IRQ is the only producer and moves
+       kbd_head (every character) and kbd_commit (end of the last complete
+       line); readers are the only consumer and move kbd_tail. */
+    uint8_t kbd_ring[KBD_RING_SIZE];
+    volatile uint32_t kbd_head;
+    volatile uint32_t kbd_commit;
+    volatile uint32_t kbd_tail;
 
     uint8_t attrib;
+    uint8_t def_attrib;
+
+    /* escape sequence parser state */
+    uint8_t esc_state;
+    uint8_t esc_nparams;
+    uint16_t esc_params[ANSI_MAX_PARAMS];
+    /* rows that scroll on a newline at scroll_bottom, inclusive */
+    uint32_t scroll_top;
+    uint32_t scroll_bottom;
 
-    volatile uint8_t ack;
+    /* a thread is waiting in read for a line of input */
     volatile uint8_t read_ack;
+    /* threads waiting for a line of input */
+    wait_queue_t input_wq;
 
     pcb_t * child_procs[MAX_PROCESSES];
     uint32_t num_procs;
@@ -44,8 +110,15 @@ terminal_t * active_term();
 uint32_t active_term_num();
 terminal_t * executing_term();
 terminal_t * get_term(uint32_t term_num);
+uint32_t live_terminals(void);
+void terminal_add_proc(terminal_t * term, pcb_t * pcb);
+void terminal_remove_proc(terminal_t * term);
 void switch_active_terminal(uint32_t term_num);
 void terminal_init();
+void terminal_scroll(terminal_t * term);
+void terminal_reset_scroll(terminal_t * term);
+void terminal_flip(terminal_t * term, uint32_t buf);
+void terminal_view_scroll(int32_t lines);
 
 /* System calls */
 /* system call for opening the terminal driver */
@@ -56,5 +129,7 @@ int32_t terminal_close(int32_t fd);
 int32_t terminal_read(int32_t fd, void* buf, int32_t nbytes);
 /* system call for writing to the terminal */
 int32_t terminal_write(int32_t fd, const void* buf, int32_t nbytes);
+/* system call for checking if the terminal can be read or written */
+int32_t terminal_poll(int32_t fd, uint32_t ** wq);
 
 #endif
@@ -10,11 +10,16 @@
 #define MAX_DATA_BLOCK_COUNT   63
 #define ELF_HEADER_SIZE        _4B
 #define ENTRYPOINT_OFFSET      24
+#define PHOFF_OFFSET           28
+#define PHNUM_OFFSET           44
+#define ELF_PT_LOAD            1
 
 #define MAX_OPEN_FILES         8
 
 #define FILE_USE_MASK          0x1
 #define FILE_TYPE_MASK         0x6
+#define FILE_NONBLOCK          0x8
+#define FILE_RAW               0x10
 
 // File usage
 #define FILE_IN_USE            1
@@ -37,16 +42,46 @@ typedef struct fs_metadata {
     uint32_t num_data_blocks;
 } fs_metadata_t;
 
+/* ELF program header, one for each segment */
+typedef struct elf_phdr {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} elf_phdr_t;
+
 typedef struct inode {
     uint32_t length;
     uint32_t data_blocks[MAX_DATA_BLOCK_COUNT];
 } inode_t;
 
+// fcntl commands and flags
+#define F_GETFL                1
+#define F_SETFL                2
+#define O_NONBLOCK             FILE_NONBLOCK
+#define O_RAW                  FILE_RAW
+#define FCNTL_FLAGS            (O_NONBLOCK | O_RAW)
+
+// Error returned by a non-blocking read that would have to sleep
+#define EAGAIN                 11
+
+// Poll events
+#define POLLIN                 0x1
+#define POLLOUT                0x4
+#define POLLNVAL               0x20
+
 typedef struct file_ops {
     int32_t (*open) (const uint8_t *);
     int32_t (*close) (int32_t);
     int32_t (*read) (int32_t, void *, int32_t);
     int32_t (*write) (int32_t, const void *, int32_t);
+    /* returns the ready POLL* events, and the wait queue that is woken up
+       when they change (NULL if they never do) */
+    int32_t (*poll) (int32_t, uint32_t **);
 } file_ops_t;
 
 typedef struct file_desc {
@@ -56,6 +91,12 @@ typedef struct file_desc {
     uint32_t flags;
 } file_desc_t;
 
+typedef struct pollfd {
+    int32_t fd;
+    uint16_t events;
+    uint16_t revents;
+} pollfd_t;
+
 /* Externally visible functions */
 
 void fs_init(void * start_addr, void * end_addr);
@@ -64,6 +105,7 @@ inode_t* get_inode_ptr(uint32_t inode);
 uint32_t get_inode_from_ptr(inode_t * inode_ptr);
 int32_t get_elf_header(uint32_t inode);
 void * get_elf_entrypoint(uint32_t inode);
+uint32_t get_elf_image_end(uint32_t inode);
 
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
@@ -73,5 +115,6 @@ int32_t fs_open(const uint8_t* filename);
 int32_t fs_close(int32_t fd);
 int32_t fs_read(int32_t fd, void* buf, int32_t nbytes);
 int32_t fs_write(int32_t fd, const void* buf, int32_t nbytes);
+int32_t fs_poll(int32_t fd, uint32_t ** wq);
 
 #endif /* FILESYSTEM_H */
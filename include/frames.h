@@ -0,0 +1,50 @@
+/*
+ * frames.h - Declares the allocator of the physical 4KB frames that back
+ * user memory and terminals
+ */
+
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include "types.h"
+#include "lib.h"
+#include "paging.h"
+
+/* Physical memory handed out as frames, identity mapped for the kernel */
+#define FRAMES_START           _8MB
+#define FRAMES_END             (_64MB + _4MB)
+#define NUM_FRAMES             ((FRAMES_END - FRAMES_START) / _4KB)
+
+/* Frames zeroed ahead of time by the idle loop */
+#define ZERO_POOL_SIZE         64
+
+/* Allocator counters, as returned to user space by frame_stats */
+typedef struct frame_stats {
+    uint32_t total_frames;
+    /* free frames, including the zeroed pool and frames being zeroed */
+    uint32_t free_frames;
+    uint32_t zeroed_frames;
+    /* most frames ever in use at once */
+    uint32_t peak_used_frames;
+    /* pages in the swap store, and the frames they are packed into */
+    uint32_t swapped_pages;
+    uint32_t swap_frames;
+    /* zeroed frames handed out from the pool, and zeroed on demand */
+    uint32_t zero_pool_hits;
+    uint32_t zero_pool_misses;
+} frame_stats_t;
+
+/* Externally visible functions */
+
+void frames_init(void);
+uint32_t alloc_frame(void);
+uint32_t alloc_zeroed_frame(void);
+void free_frame(uint32_t phys_addr);
+uint32_t free_frame_count(void);
+int32_t zero_pool_refill(uint32_t * in_flight);
+void zero_pool_cancel(uint32_t * in_flight);
+
+/* system call for reading the allocator counters */
+int32_t frame_stats(frame_stats_t * stats);
+
+#endif /* FRAMES_H */
@@ -0,0 +1,20 @@
+/*
+ * futex.h - Declares the fast user-space mutex (futex) syscalls
+ */
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "types.h"
+
+/* Number of wait queues that futex addresses are hashed into */
+#define FUTEX_HASH_SIZE        16
+#define FUTEX_HASH(key)        (((key) >> 2) % FUTEX_HASH_SIZE)
+
+/* Externally visible functions */
+
+int32_t futex_wait(uint32_t * addr, uint32_t val);
+int32_t futex_wake(uint32_t * addr, uint32_t n);
+int32_t futex_frame_in_use(uint32_t frame);
+
+#endif /* FUTEX_H */
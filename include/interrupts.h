@@ -18,12 +18,52 @@
  *                 using "iret"
  */
 
+extern void divide_error_exception(void);
+
+extern void debug_exception(void);
+
+extern void nmi_exception(void);
+
+extern void int3_exception(void);
+
+extern void overflow_exception(void);
+
+extern void bounds_exception(void);
+
+extern void invalid_op_exception(void);
+
+extern void device_not_available_exception(void);
+
+extern void doublefault_exception(void);
+
+extern void coprocessor_seg_overrun_exception(void);
+
+extern void invalid_TSS_exception(void);
+
+extern void seg_not_present_exception(void);
+
+extern void stack_fault_exception(void);
+
+extern void gpf_exception(void);
+
+extern void page_fault_exception(void);
+
+extern void fpu_coprocessor_error_exception(void);
+
+extern void alignment_check_exception(void);
+
+extern void machine_check_exception(void);
+
+extern void simd_coprocessor_error_exception(void);
+
 extern void keyboard_irq(void);
 
 extern void rtc_irq(void);
 
 extern void pit_irq(void);
 
+extern void serial_irq(void);
+
 extern void pic_irq_master(void);
 
 extern void pic_irq_slave(void);
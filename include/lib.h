@@ -11,6 +11,7 @@
 #define _1KB              0x400
 #define _4KB              0x1000
 #define _8KB              0x2000
+#define _2MB              0x200000
 #define _4MB              0x400000
 #define _8MB              0x800000
 #define _64MB             0x4000000
@@ -18,10 +19,10 @@
 
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
-void putc_buffer(uint8_t c);
 int32_t puts(int8_t *s);
-void shift_display(char* write_mem);
 void update_cursor(int col, int row);
+void set_display_start(uint32_t offset);
+void wait_vretrace(void);
 void do_backspace();
 int8_t *itoa(uint32_t value, int8_t* buf, int32_t radix);
 int8_t *strrev(int8_t* s);
@@ -0,0 +1,29 @@
+/*
+ * lz.h - Declares the LZ77 codec used to compress swapped out pages
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include "types.h"
+
+/* Matches are at least 4 bytes long and at most 64KB back */
+#define LZ_MIN_MATCH           4
+#define LZ_MAX_OFFSET          0xFFFF
+
+/* Lengths in a token nibble, longer ones continue in extra bytes */
+#define LZ_NIBBLE_MAX          15
+#define LZ_BYTE_MAX            255
+
+/* Positions of earlier 4 byte sequences, hashed */
+#define LZ_HASH_BITS           12
+#define LZ_HASH_SIZE           (1 << LZ_HASH_BITS)
+
+/* Externally visible functions */
+
+int32_t lz_compress(const uint8_t * src, uint32_t len, uint8_t * dst,
+                    uint32_t cap);
+int32_t lz_decompress(const uint8_t * src, uint32_t len, uint8_t * dst,
+                      uint32_t cap);
+
+#endif /* LZ_H */
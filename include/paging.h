@@ -14,14 +14,67 @@
 #define PAGE_COUNT                1024
 #define PAGE_ALIGN                4096
 
+/* Building with PAE_PAGING defined switches to PAE: 64-bit entries, a
+   4-entry page directory pointer table above each directory, 2MB large
+   pages and no-execute. The bitfield entries below are still what callers
+   build; PAE keeps the same bits in the low half of its entries. */
+#ifdef PAE_PAGING
+typedef uint64_t page_entry_t;
+#define SHIFT_LARGE               21
+#define LARGE_PAGE_SIZE           _2MB
+#define TABLE_ENTRIES             512
+#define PDPT_ENTRIES              4
+#define PAGE_NX                   0x8000000000000000ULL
+#else
+typedef uint32_t page_entry_t;
+#define SHIFT_LARGE               SHIFT_4MB
+#define LARGE_PAGE_SIZE           _4MB
+#define TABLE_ENTRIES             PAGE_COUNT
+#endif
+
 #define VIDEO_MEM_START           0xB8000  // start of video memory
-#define VIDEO_MEM_PG_COUNT        1    // number of pages in video memory (32KB)
+#define VIDEO_MEM_PG_COUNT        8    // number of pages in video memory (32KB)
 #define VIDEO_MEM_INDEX           (VIDEO_MEM_START / PAGE_ALIGN) // 0xB8
 
 #define KERNEL_MEM_START          _4MB // start of 4MB Kernel in memory
 
-#define VID_BKUP_MEM_START_VIRT   (_128MB + _8MB)
-#define VID_BKUP_MEM_START_PHYS   _64MB
+/* User address space: the image and the stacks share the first 4MB, the
+   vidmap pages get the next 4MB table, and the heap grows above them */
+#define USER_MEM_START            _128MB
+#define USER_STACK_TOP            (_128MB + _4MB)
+#define USER_HEAP_START           (_128MB + 2 * _4MB)
+#define USER_HEAP_END             (_128MB + _64MB)
+
+#define PAGE_ROUND_UP(addr)       (((addr) + _4KB - 1) & ~(_4KB - 1))
+
+/* Bits of a raw directory/table entry */
+#define PAGE_PRESENT              0x1
+#define PAGE_USER                 0x4
+#define PAGE_ACCESSED             0x20
+#define PAGE_DIRTY                0x40
+#define PAGE_SIZE_4MB             0x80     // a 2MB page with PAE
+#define PAGE_OWNED                0x200
+/* not present, the page is in the swap store and the slot is in the frame
+   bits */
+#define PAGE_SWAPPED              0x400
+
+/* value of the available bits for a frame the process owns and frees */
+#define PAGE_AVAIL_OWNED          0x1
+
+/* Memory use of a process, as returned to user space by mem_stats */
+typedef struct mem_stats {
+    /* user pages mapped, and those of them the process does not own */
+    uint32_t resident_pages;
+    uint32_t shared_pages;
+    uint32_t peak_resident_pages;
+    /* pages in the swap store */
+    uint32_t swapped_pages;
+    /* frames holding the process' page tables */
+    uint32_t table_pages;
+    /* faults served by mapping a fresh page, and by reading one back in */
+    uint32_t minor_faults;
+    uint32_t major_faults;
+} mem_stats_t;
 
 typedef struct __attribute__((packed)) pde_4M {
     uint32_t present : 1;
@@ -73,13 +126,34 @@ void init_paging(void);
 
 void map_page_4MB(uint32_t vir_addr, pde_4M_t pde);
 void map_actual_vidmem(uint32_t phys_addr);
+void set_vidmem_pte(pte_t * pte, uint32_t phys_addr);
+void map_proc_page(uint32_t pid, uint32_t vir_addr, pte_t pte);
 void map_user_video_mem(uint32_t vir_addr, pte_t pte);
-void free_user_video_mem(uint32_t vir_addr);
-void map_backup_vidmem(uint32_t vir_addr, uint32_t phys_addr);
+void tlb_batch_begin(void);
+void tlb_batch_end(void);
 void flush_tlb();
+int32_t map_user_pages(uint32_t start, uint32_t end);
+void unmap_user_pages(uint32_t start, uint32_t end);
+int32_t user_range_mapped(uint32_t addr, uint32_t len);
+void init_page_directory(uint32_t pid);
+void free_user_space(uint32_t pid);
+void switch_page_directory(uint32_t pid);
+uint32_t virt_to_phys(uint32_t vir_addr);
+void count_page_fault(int32_t major);
+int32_t swap_in_page(uint32_t vir_addr);
+uint32_t reclaim_idle_pages(uint32_t count);
+
+/* system call for reading the memory use of a process */
+int32_t mem_stats(int32_t pid, mem_stats_t * stats);
 
 /* Functions defined in Assembly */
 extern void load_page_directory(uint32_t pagedir_addr);
 extern void enable_paging(void);
+extern int32_t enable_global_pages(void);
+extern int32_t enable_pat_wc(void);
+extern uint32_t cpu_features(void);
+#ifdef PAE_PAGING
+extern int32_t enable_nx(void);
+#endif
 
 #endif
@@ -6,12 +6,39 @@
 #include "lib.h"
 #include "paging.h"
 #include "filesystem.h"
+#include "signal.h"
 
 #define ESP_PCB_MASK           0xFFFFE000
 #define MAX_PROCESSES          6
 #define ARGS_LENGTH            128
 #define RETURN_EXCEPTION       256
 
+/* off-screen buffers a process draws into and presents with flip */
+#define NUM_VIDBUFS            2
+
+/* Threads - each thread's user stack is a slot below the main stack */
+#define THREAD_STACK_SIZE      (16 * _4KB)
+#define THREAD_FRAME_WORDS     5    // EIP, CS, EFLAGS, ESP, SS
+/* Stacks start with one page and grow down through their slot. Faults this
+   far below the stack pointer still grow it, for push, pusha and the
+   frames of signal handlers. */
+#define USER_STACK_INIT_SIZE   _4KB
+#define STACK_GROW_SLACK       256
+
+/* the stack slots of all threads, the image has to end below them */
+#define USER_STACKS_BOTTOM     \
+    (USER_STACK_TOP - MAX_PROCESSES * THREAD_STACK_SIZE)
+
+/* Scheduling states of a PCB */
+#define TASK_RUNNABLE          0
+#define TASK_NEW               1
+#define TASK_DEAD              2
+#define TASK_BLOCKED           3
+
+/* A wait queue is the set of PIDs sleeping on it */
+typedef uint32_t wait_queue_t;
+#define PID_MASK(pid)          (1 << (pid))
+
 /* PIT Constants */
 #define PIT_IRQ                0
 
@@ -23,6 +50,7 @@
 #define PIT_CMD_VAL            0x36
 /* 25 ms = 40 Hz */
 #define PIT_25MS               (PIT_BASE_FREQ / 40)
+#define PIT_TICK_MS            25
 #define PIT_200MS              (PIT_BASE_FREQ / 5)
 
 typedef struct pcb pcb_t;
@@ -32,10 +60,11 @@ struct pcb {
 
     int32_t retval;
 
-    pde_4M_t pde;
-    uint32_t pde_virt_addr;
+    /* end of the heap, grown and shrunk by sbrk */
+    uint32_t brk;
     pte_t vidmem_pte;
     uint32_t vidmem_virt_addr;
+    uint32_t vidbuf_virt_addr;
 
     uint32_t esp;
     uint32_t ebp;
@@ -47,23 +76,65 @@ struct pcb {
     uint32_t args_length;
 
     pcb_t * parent;
+
+    /* Threads - the leader owns the fds, args, vidmap and the 4MB page */
+    uint32_t state;
+    uint32_t term_num;
+    uint32_t stack_slot;
+    uint32_t used_stack_slots;
+    pcb_t * leader;
+    pcb_t * next_thread;
+    pcb_t * curr_thread;
+
+    /* physical address of the futex this thread sleeps on (0 if none) */
+    uint32_t futex_key;
+    /* PIT tick at which a sleeping thread times out (0 if none) */
+    uint32_t wake_tick;
+    /* free frame the idle loop is zeroing on this stack (0 if none) */
+    uint32_t zeroing_frame;
+
+    /* Signals - kept by the leader for the whole process */
+    void * sig_handlers[NUM_SIGNALS];
+    uint32_t sig_pending;
+    uint32_t sig_masked;
+    uint32_t alarm_tick;
 };
 
 /* External functions */
 pcb_t* get_pcb();
+pcb_t* get_process();
+pcb_t* get_pcb_by_pid(uint32_t pid);
 
 int32_t get_available_pid();
 
 int32_t free_pid(uint32_t pid);
 
+int32_t grow_user_stack(uint32_t addr, uint32_t user_esp);
+int32_t process_idle(pcb_t * leader);
+
+/* Thread functions */
+void thread_exit(void);
+void kill_threads(pcb_t * leader);
+
 /* Scheduling functions */
 void pit_init(void);
 
+uint32_t get_pit_ticks();
 uint32_t get_exec_term_num();
 void set_exec_term_num(uint32_t num);
-void context_switch(uint32_t next_term);
+void context_switch(pcb_t * new_pcb);
+void schedule(void);
+
+/* Sleeping and waking up */
+void wait_on(wait_queue_t * wq);
+void sleep_thread(void);
+void wake_up(wait_queue_t * wq);
+void wake_thread(pcb_t * pcb);
 
 /* Handles the programmable interrupt timer (PIT) interrupts */
 extern void pit_interrupt_handler(void);
 
+/* Enters user mode for a newly created thread (defined in Assembly) */
+extern void thread_start(void);
+
 #endif
@@ -0,0 +1,72 @@
+/*
+ * signal.h - Declares the signal delivery functions and the hardware context
+ *            that is saved on the kernel stack on every entry from user mode
+ */
+
+#ifndef SIGNAL_H
+#define SIGNAL_H
+
+#include "types.h"
+
+/* Signal numbers. A division by zero in user mode raises SIG_DIV_ZERO, and
+   any other exception SIG_SEGFAULT. */
+#define SIG_DIV_ZERO           0
+#define SIG_SEGFAULT           1
+#define SIG_INTERRUPT          2
+#define SIG_ALARM              3
+#define SIG_USER1              4
+#define NUM_SIGNALS            5
+
+#define SIG_MASK(signum)       (1 << (signum))
+#define SIG_ALL_MASK           ((1 << NUM_SIGNALS) - 1)
+/* Signals whose default action is to kill the process */
+#define SIG_KILL_MASK          (SIG_MASK(SIG_DIV_ZERO) | \
+                                SIG_MASK(SIG_SEGFAULT) | \
+                                SIG_MASK(SIG_INTERRUPT))
+
+/* Size of the sigreturn trampoline code pushed onto the user stack */
+#define SIG_TRAMPOLINE_SIZE    8
+
+/* User-settable EFLAGS bits restored by sigreturn (CF, PF, AF, ZF, SF, TF,
+   DF, OF) */
+#define EFLAGS_USER_MASK       0xDD5
+
+/*
+ * Registers saved on the kernel stack when entering the kernel through a
+ * system call or an interrupt. Must match the push order in syscalls_asm.S
+ * and interrupts.S.
+ */
+typedef struct hw_context {
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t ebp;
+    uint32_t eax;
+    uint32_t ds;
+    uint32_t es;
+    uint32_t fs;
+    /* pushed by the processor */
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+} hw_context_t;
+
+/* The context a thread entered the kernel with from user mode */
+#define USER_CONTEXT(pcb) \
+    ((hw_context_t *)((pcb)->esp0 - sizeof(hw_context_t)))
+
+/* Externally visible functions */
+
+struct pcb;
+void send_signal(struct pcb * process, uint32_t signum);
+int32_t signal_pending(void);
+void do_signal(hw_context_t * context);
+
+/* system call for scheduling a SIG_ALARM */
+int32_t alarm(uint32_t ms);
+
+#endif /* SIGNAL_H */
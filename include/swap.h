@@ -0,0 +1,36 @@
+/*
+ * swap.h - Declares the compressed in-RAM store for swapped out user pages
+ */
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "types.h"
+#include "lib.h"
+#include "frames.h"
+
+/* Compressed pages are packed into store frames in 256 byte chunks */
+#define SWAP_CHUNK_SIZE        256
+#define SWAP_CHUNKS            (_4KB / SWAP_CHUNK_SIZE)
+/* pages that do not compress to 3KB stay in RAM */
+#define SWAP_MAX_CHUNKS        12
+
+/* Up to 4MB of store frames, holding up to 8192 pages */
+#define SWAP_STORE_FRAMES      1024
+#define SWAP_SLOTS             8192
+
+/* The idle loop evicts pages while fewer frames than this are free, and
+   each pass or failed allocation evicts up to a batch of them */
+#define SWAP_LOW_WATER         (NUM_FRAMES / 8)
+#define SWAP_RECLAIM_BATCH     8
+
+/* Externally visible functions */
+
+void swap_init(void);
+int32_t swap_out(uint32_t frame);
+int32_t swap_in(uint32_t slot, uint32_t frame);
+void swap_free(uint32_t slot);
+uint32_t swapped_page_count(void);
+uint32_t swap_frame_count(void);
+
+#endif /* SWAP_H */
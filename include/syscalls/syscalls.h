@@ -13,6 +13,8 @@
 #define BASE_ADDR_4MB_OFFSET      22
 #define IMAGE_LOAD_OFFSET         0x48000
 #define USER_VIDEO_MEM_ADDR       (_128MB + _4MB)
+/* the off-screen buffers follow the vidmap page */
+#define USER_VIDBUF_ADDR          (USER_VIDEO_MEM_ADDR + _4KB)
 
 #define SYS_HALT                  1
 #define SYS_EXECUTE               2
@@ -24,6 +26,19 @@
 #define SYS_VIDMAP                8
 #define SYS_SET_HANDLER           9
 #define SYS_SIGRETURN             10
+#define SYS_THREAD_CREATE         11
+#define SYS_FUTEX_WAIT            12
+#define SYS_FUTEX_WAKE            13
+#define SYS_ALARM                 14
+#define SYS_POLL                  15
+#define SYS_FCNTL                 16
+#define SYS_VIDMAP_BUFFERS        17
+#define SYS_FLIP                  18
+#define SYS_SBRK                  19
+#define SYS_FRAME_STATS           20
+#define SYS_MEM_STATS             21
+
+#define USER_EFLAGS               0x202  // IF and reserved bit 1 set
 
 /* External functions */
 extern int32_t syscall_handler();
@@ -39,5 +54,11 @@ extern int32_t getargs(uint8_t * buf, int32_t nbytes);
 extern int32_t vidmap(uint8_t** screen_start);
 extern int32_t set_handler(int32_t signum, void * handler);
 extern int32_t sigreturn(void);
+extern int32_t thread_create(void * entry, void * arg);
+extern int32_t poll(pollfd_t * fds, uint32_t nfds, int32_t timeout);
+extern int32_t fcntl(int32_t fd, int32_t cmd, uint32_t arg);
+extern int32_t vidmap_buffers(uint8_t** buffers);
+extern int32_t flip(int32_t buf);
+extern int32_t sbrk(int32_t increment);
 
 #endif
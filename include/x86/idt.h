@@ -33,6 +33,21 @@
 #define INT_GATE_RESERVED_3      0
 #define TRAP_GATE_RESERVED_3     1
 
+/* Page fault error code bits */
+#define PF_PRESENT               0x1
+#define PF_USER                  0x4
+
+/* The error code and IRET context the processor pushes for a page fault */
+typedef struct page_fault_frame {
+    uint32_t error;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    /* only pushed if the fault came from user mode */
+    uint32_t esp;
+    uint32_t ss;
+} page_fault_frame_t;
+
 
 /* External functions */
 
@@ -16,6 +16,9 @@
 #define KERNEL_TSS 0x0030
 #define KERNEL_LDT 0x0038
 
+/* Requested privilege level bits of a user segment selector */
+#define USER_PRIVILEGE 0x0003
+
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE 104
 
@@ -0,0 +1,315 @@
+/*
+ * ansi.c
+ * Table-driven VT100/ANSI escape sequence parser. Plain text never comes
+ * here: terminal_write only hands over bytes from an ESC until the
+ * sequence ends.
+ */
+
+#include "drivers/ansi.h"
+#include "drivers/terminal.h"
+#include "lib.h"
+
+/* Character classes */
+#define CC_OTHER            0
+#define CC_ESC              1
+#define CC_BRACKET          2
+#define CC_DIGIT            3
+#define CC_SEMI             4
+#define CC_PRIVATE          5
+#define CC_FINAL            6
+#define ANSI_CLASSES        7
+
+/* Actions */
+#define ACT_NONE            0
+#define ACT_CLEAR           1
+#define ACT_PARAM           2
+#define ACT_NEXT            3
+#define ACT_DISPATCH        4
+
+typedef struct ansi_transition {
+    uint8_t action;
+    uint8_t next;
+} ansi_transition_t;
+
+static const ansi_transition_t ansi_table[ANSI_STATES][ANSI_CLASSES] = {
+    /* ANSI_GROUND: only ESC is ever fed in this state */
+    {
+        {ACT_NONE, ANSI_GROUND},    {ACT_NONE, ANSI_ESCAPE},
+        {ACT_NONE, ANSI_GROUND},    {ACT_NONE, ANSI_GROUND},
+        {ACT_NONE, ANSI_GROUND},    {ACT_NONE, ANSI_GROUND},
+        {ACT_NONE, ANSI_GROUND}
+    },
+    /* ANSI_ESCAPE: only CSI sequences are supported */
+    {
+        {ACT_NONE, ANSI_GROUND},    {ACT_NONE, ANSI_ESCAPE},
+        {ACT_CLEAR, ANSI_CSI},      {ACT_NONE, ANSI_GROUND},
+        {ACT_NONE, ANSI_GROUND},    {ACT_NONE, ANSI_GROUND},
+        {ACT_NONE, ANSI_GROUND}
+    },
+    /* ANSI_CSI */
+    {
+        {ACT_NONE, ANSI_GROUND},    {ACT_NONE, ANSI_ESCAPE},
+        {ACT_NONE, ANSI_GROUND},    {ACT_PARAM, ANSI_CSI},
+        {ACT_NEXT, ANSI_CSI},       {ACT_NONE, ANSI_CSI},
+        {ACT_DISPATCH, ANSI_GROUND}
+    }
+};
+
+/* ANSI colour number to VGA colour number */
+static const uint8_t ansi_colors[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+
+/*
+ * ansi_class
+ *   DESCRIPTION: Returns the parser's character class of a byte
+ *   INPUTS: c - the byte
+ *   OUTPUTS: none
+ *   RETURN VALUE: one of the CC_* classes
+ *   SIDE EFFECTS: none
+ */
+static uint8_t
+ansi_class(uint8_t c)
+{
+    if (c == ANSI_ESC)
+        return CC_ESC;
+    if (c == '[')
+        return CC_BRACKET;
+    if (c >= '0' && c <= '9')
+        return CC_DIGIT;
+    if (c == ';')
+        return CC_SEMI;
+    if (c >= '<' && c <= '?')
+        return CC_PRIVATE;
+    if (c >= '@' && c <= '~')
+        return CC_FINAL;
+    return CC_OTHER;
+}
+
+
+/*
+ * ansi_param
+ *   DESCRIPTION: Returns a CSI parameter, or a default if it was not given
+ *   INPUTS: term - the terminal
+ *           i - the parameter number
+ *           def - the default value
+ *   OUTPUTS: none
+ *   RETURN VALUE: the parameter value
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+ansi_param(terminal_t * term, uint32_t i, uint32_t def)
+{
+    if (i >= term->esc_nparams || term->esc_params[i] == 0)
+        return def;
+    return term->esc_params[i];
+}
+
+
+/*
+ * ansi_erase
+ *   DESCRIPTION: Fills a range of the screen with blanks in the current
+ *                colours
+ *   INPUTS: term - the terminal
+ *           from, to - the first and one past the last cell to erase
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes video memory
+ */
+static void
+ansi_erase(terminal_t * term, uint32_t from, uint32_t to)
+{
+    if (to > from)
+        memset_word(TERM_SCREEN(term) + from * 2,
+                    (term->attrib << 8) | ' ', to - from);
+}
+
+
+/*
+ * ansi_sgr
+ *   DESCRIPTION: Applies Select Graphic Rendition parameters to the
+ *                terminal's colour attribute
+ *   INPUTS: term - the terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the terminal's attribute
+ */
+static void
+ansi_sgr(terminal_t * term)
+{
+    uint32_t i, p;
+
+    /* ESC[m is a reset */
+    if (term->esc_nparams == 0)
+        term->esc_params[term->esc_nparams++] = SGR_RESET;
+
+    for (i = 0; i < term->esc_nparams; i++)
+    {
+        p = term->esc_params[i];
+
+        if (p == SGR_RESET)
+            term->attrib = term->def_attrib;
+        else if (p == SGR_BOLD)
+            term->attrib |= ATTRIB_BRIGHT;
+        else if (p == SGR_NORMAL)
+            term->attrib &= ~ATTRIB_BRIGHT;
+        else if (p >= SGR_FG_FIRST && p <= SGR_FG_LAST)
+            term->attrib = (term->attrib & (ATTRIB_BG_MASK | ATTRIB_BRIGHT)) |
+                           ansi_colors[p - SGR_FG_FIRST];
+        else if (p == SGR_FG_DEFAULT)
+            term->attrib = (term->attrib & ATTRIB_BG_MASK) |
+                           (term->def_attrib & ATTRIB_FG_MASK);
+        else if (p >= SGR_BG_FIRST && p <= SGR_BG_LAST)
+            term->attrib = (term->attrib & ATTRIB_FG_MASK) |
+                           (ansi_colors[p - SGR_BG_FIRST] << ATTRIB_BG_SHIFT);
+        else if (p == SGR_BG_DEFAULT)
+            term->attrib = (term->attrib & ATTRIB_FG_MASK) |
+                           (term->def_attrib & ATTRIB_BG_MASK);
+    }
+}
+
+
+/*
+ * ansi_dispatch
+ *   DESCRIPTION: Runs a complete CSI sequence. Supports cursor movement
+ *                (A, B, C, D, H, f), erase in display (J), erase in line (K),
+ *                colours (m) and the scroll region (r). Others are ignored.
+ *   INPUTS: term - the terminal
+ *           final - the final byte of the sequence
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the cursor, colours, scroll region and screen
+ */
+static void
+ansi_dispatch(terminal_t * term, uint8_t final)
+{
+    uint32_t n, cursor, top, bottom;
+
+    cursor = term->y_pos * NUM_COLS + term->x_pos;
+
+    switch (final)
+    {
+        case 'A':
+            n = ansi_param(term, 0, 1);
+            term->y_pos = (n > term->y_pos) ? 0 : term->y_pos - n;
+            break;
+
+        case 'B':
+            n = ansi_param(term, 0, 1);
+            term->y_pos = (term->y_pos + n >= NUM_ROWS) ?
+                          NUM_ROWS - 1 : term->y_pos + n;
+            break;
+
+        case 'C':
+            n = ansi_param(term, 0, 1);
+            term->x_pos = (term->x_pos + n >= NUM_COLS) ?
+                          NUM_COLS - 1 : term->x_pos + n;
+            break;
+
+        case 'D':
+            n = ansi_param(term, 0, 1);
+            term->x_pos = (n > term->x_pos) ? 0 : term->x_pos - n;
+            break;
+
+        case 'H':
+        case 'f':
+            n = ansi_param(term, 0, 1);
+            term->y_pos = (n > NUM_ROWS) ? NUM_ROWS - 1 : n - 1;
+            n = ansi_param(term, 1, 1);
+            term->x_pos = (n > NUM_COLS) ? NUM_COLS - 1 : n - 1;
+            break;
+
+        case 'J':
+            n = ansi_param(term, 0, 0);
+            if (n == 0)
+                ansi_erase(term, cursor, NUM_ROWS * NUM_COLS);
+            else if (n == 1)
+                ansi_erase(term, 0, cursor + 1);
+            else if (n == 2)
+                ansi_erase(term, 0, NUM_ROWS * NUM_COLS);
+            break;
+
+        case 'K':
+            n = ansi_param(term, 0, 0);
+            if (n == 0)
+                ansi_erase(term, cursor, cursor - term->x_pos + NUM_COLS);
+            else if (n == 1)
+                ansi_erase(term, cursor - term->x_pos, cursor + 1);
+            else if (n == 2)
+                ansi_erase(term, cursor - term->x_pos,
+                           cursor - term->x_pos + NUM_COLS);
+            break;
+
+        case 'm':
+            ansi_sgr(term);
+            break;
+
+        case 'r':
+            top = ansi_param(term, 0, 1);
+            bottom = ansi_param(term, 1, NUM_ROWS);
+            if (top < bottom && bottom <= NUM_ROWS)
+            {
+                term->scroll_top = top - 1;
+                term->scroll_bottom = bottom - 1;
+                term->x_pos = 0;
+                term->y_pos = 0;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/*
+ * ansi_putc
+ *   DESCRIPTION: Feeds one byte of an escape sequence to the terminal's
+ *                parser, looking up the action and next state in the
+ *                transition table
+ *   INPUTS: term - the terminal being written
+ *           c - the byte
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the cursor, colours, scroll region and screen
+ */
+void
+ansi_putc(terminal_t * term, uint8_t c)
+{
+    const ansi_transition_t * t;
+    uint16_t * param;
+
+    t = &ansi_table[term->esc_state][ansi_class(c)];
+
+    switch (t->action)
+    {
+        case ACT_CLEAR:
+            memset(term->esc_params, 0, sizeof(term->esc_params));
+            term->esc_nparams = 0;
+            break;
+
+        case ACT_PARAM:
+            if (term->esc_nparams == 0)
+                term->esc_nparams = 1;
+            param = &term->esc_params[term->esc_nparams - 1];
+            if (*param <= (ANSI_PARAM_MAX - 9) / 10)
+                *param = *param * 10 + (c - '0');
+            break;
+
+        case ACT_NEXT:
+            if (term->esc_nparams == 0)
+                term->esc_nparams = 1;
+            if (term->esc_nparams < ANSI_MAX_PARAMS)
+                term->esc_nparams++;
+            term->esc_params[term->esc_nparams - 1] = 0;
+            break;
+
+        case ACT_DISPATCH:
+            ansi_dispatch(term, c);
+            break;
+
+        default:
+            break;
+    }
+
+    term->esc_state = t->next;
+}
@@ -9,6 +9,7 @@
 #include "drivers/terminal.h"
 #include "x86/i8259.h"
 #include "lib.h"
+#include "signal.h"
 
 /* flags keeps tracks of all the special keys */
 static uint8_t l_shift;
@@ -76,6 +77,86 @@ const static unsigned char scan_code_1[2][SUPPORTED_KEYS] = {
 };
 
 
+/* keeps the compiler from reordering ring stores around index updates */
+#define barrier()   asm volatile("" : : : "memory")
+
+
+/*
+ * kbd_put
+ *   DESCRIPTION: Adds a character to the end of the active terminal's
+ *                current (uncommitted) input line. Only called from the
+ *                keyboard IRQ.
+ *   INPUTS: c - the character
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if added, 0 if the ring is full
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+kbd_put(uint8_t c)
+{
+    terminal_t * term = active_term();
+
+    if (term->kbd_head - term->kbd_tail >= KBD_RING_SIZE)
+        return 0;
+
+    term->kbd_ring[term->kbd_head & KBD_RING_MASK] = c;
+    barrier();
+    term->kbd_head++;
+    return 1;
+}
+
+
+/*
+ * kbd_line_length
+ *   DESCRIPTION: Returns the length of the active terminal's current input
+ *                line
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of uncommitted characters
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+kbd_line_length(void)
+{
+    return active_term()->kbd_head - active_term()->kbd_commit;
+}
+
+
+/*
+ * input_ready
+ *   DESCRIPTION: Commits the active terminal's current input line, making it
+ *                readable, and wakes up the threads reading or polling it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+input_ready(void)
+{
+    barrier();
+    active_term()->kbd_commit = active_term()->kbd_head;
+    wake_up(&active_term()->input_wq);
+}
+
+
+/*
+ * keyboard_end_line
+ *   DESCRIPTION: Ends the active terminal's current input line as if Enter
+ *                was pressed, without echoing it
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Wakes up the threads reading the terminal
+ */
+void
+keyboard_end_line(void)
+{
+    kbd_put('\n');
+    input_ready();
+}
+
+
 /*
  * keyboard_init
  *   DESCRIPTION: Initializes the keyboard and local variables
@@ -87,12 +168,6 @@ const static unsigned char scan_code_1[2][SUPPORTED_KEYS] = {
 void
 keyboard_init()
 {
-    /* clear the buffer */
-    memset(active_term()->buffer, '\0', MAX_BUFFER_SIZE);
-
-    active_term()->buffer_size = 0;
-    active_term()->ack = 0;
-    active_term()->read_ack = 0;
     l_shift = 0;
     r_shift = 0;
     caps = 0;
@@ -113,7 +188,7 @@ keyboard_init()
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Prints the character to the screen, and fills the buffer
+ *   SIDE EFFECTS: Prints the character to the screen, and fills the input ring
  */
 void
 keyboard_interrupt_handler()
@@ -138,15 +213,40 @@ keyboard_interrupt_handler()
         return;
     }
 
+    if (check_scroll_keys(c))
+    {
+        send_eoi(KEYBOARD_IRQ);
+        enable_irq(KEYBOARD_IRQ);
+        return;
+    }
+
+    /* raw mode delivers every key to the program as it is pressed */
+    if (check_raw_mode(c))
+    {
+        send_eoi(KEYBOARD_IRQ);
+        enable_irq(KEYBOARD_IRQ);
+        return;
+    }
+
+    /* CTRL-C interrupts the running program, unless it is reading input */
+    if ((l_ctrl || r_ctrl) && c == SCAN_C && !active_term()->read_ack &&
+        active_term()->num_procs > 0)
+    {
+        /* throw away the line being typed */
+        active_term()->kbd_head = active_term()->kbd_commit;
+        send_signal(active_term()->child_procs[active_term()->num_procs - 1],
+                    SIG_INTERRUPT);
+        send_eoi(KEYBOARD_IRQ);
+        enable_irq(KEYBOARD_IRQ);
+        return;
+    }
+
     /* check if user has pressed any control code combinations */
-    if (active_term()->read_ack)
+    if (check_control_codes(c))
     {
-        if (check_control_codes(c))
-        {
-            send_eoi(KEYBOARD_IRQ);
-            enable_irq(KEYBOARD_IRQ);
-            return;
-        }
+        send_eoi(KEYBOARD_IRQ);
+        enable_irq(KEYBOARD_IRQ);
+        return;
     }
 
     /* Check if any button is being pressed */
@@ -155,17 +255,10 @@ keyboard_interrupt_handler()
         /* handle backspace input */
         if(c == BACKSPACE)
         {
-            if (active_term()->buffer_size == 0)
+            /* only the line being typed can be edited */
+            if (kbd_line_length() > 0)
             {
-                /* don't do backspace if buffer is empty */
-                send_eoi(KEYBOARD_IRQ);
-                enable_irq(KEYBOARD_IRQ);
-                return;
-            }
-            if (active_term()->read_ack)
-            {
-                active_term()->buffer_size--;
-                active_term()->buffer[active_term()->buffer_size] = '\0';
+                active_term()->kbd_head--;
                 do_backspace();
             }
             send_eoi(KEYBOARD_IRQ);
@@ -176,13 +269,11 @@ keyboard_interrupt_handler()
         /* handle enter key */
         if(c == ENTER_KEYCODE)
         {
-            if (active_term()->read_ack)
+            if (kbd_put('\n'))
             {
-                active_term()->buffer[active_term()->buffer_size] = '\n';
-                active_term()->buffer_size++;
+                input_ready();
+                putc('\n');
             }
-            active_term()->ack = 1;
-            putc('\n');
             send_eoi(KEYBOARD_IRQ);
             enable_irq(KEYBOARD_IRQ);
             return;
@@ -191,12 +282,10 @@ keyboard_interrupt_handler()
         /* otherwise print the character */
         print_character(c);
 
-        /* check for buffer filled */
-        if(active_term()->buffer_size >= MAX_BUFFER_SIZE - 2)
+        /* check for line filled */
+        if(kbd_line_length() >= MAX_BUFFER_SIZE - 2 && kbd_put('\n'))
         {
-            active_term()->buffer[active_term()->buffer_size] = '\n';
-            active_term()->buffer_size++;
-            active_term()->ack = 1;
+            input_ready();
             putc('\n');
             send_eoi(KEYBOARD_IRQ);
             enable_irq(KEYBOARD_IRQ);
@@ -211,44 +300,76 @@ keyboard_interrupt_handler()
 
 /*
  * keyboard_read
- *   DESCRIPTION: This function reads inputs from the keyboard.
- *                This function blocks until ack is true.
- *                Here, ack true implies the following:
+ *   DESCRIPTION: This function reads one line of input from the keyboard,
+ *                or in raw mode every key typed so far.
+ *                This function sleeps until a line is complete, which
+ *                happens when:
  *                1. The user pressed enter
- *                2. The command buffer is filled
- *   INPUTS: fd - File Descriptor (unused)
- *           buf - The destination to copy the input buffer contents to
- *           nbytes - The size of the buffer filled
+ *                2. The line filled up
+ *                3. A control code was typed
+ *                Lines typed before the read are kept and returned in order.
+ *   INPUTS: fd - File Descriptor, checked for O_NONBLOCK
+ *           buf - The destination to copy the line to
+ *           nbytes - The size of buf; the rest of a longer line is kept for
+ *                    the next read
  *   OUTPUTS: none
- *   RETURN VALUE: returns the number of bytes in the buffer
- *   SIDE EFFECTS: Flushes the buffer provided with the input buffer
+ *   RETURN VALUE: returns the number of bytes copied
+ *                 -EAGAIN - no complete line yet and fd is non-blocking
+ *                 -1 - interrupted by a signal
+ *   SIDE EFFECTS: Consumes the line from the terminal's input ring
  */
 int
 keyboard_read(int32_t fd, void* buf, int32_t nbytes)
 {
-    /* allow buffer filling */
-    executing_term()->read_ack = 1;
-    /* resetting flag at every read */
-    executing_term()->ack = 0;
-    /* spin until user presses Enter or the buffer has been filled */
-    while(!executing_term()->ack);
-
-    executing_term()->ack = 0;
-    executing_term()->read_ack = 0;
-    disable_irq(KEYBOARD_IRQ);
-    uint32_t size;
+    terminal_t * term = executing_term();
+    uint32_t flags, tail, commit;
+    int32_t i, raw;
+    uint8_t c;
 
-    if(executing_term()->buffer_size < nbytes)
-        size = executing_term()->buffer_size;
-    else
-        size = nbytes;
+    raw = get_process()->fds[fd].flags & FILE_RAW;
 
-    memcpy(buf, executing_term()->buffer, size);
-    memset(executing_term()->buffer, '\0', MAX_BUFFER_SIZE);
-    executing_term()->buffer_size = 0;
-    enable_irq(KEYBOARD_IRQ);
+    cli_and_save(flags);
+
+    /* sleep until user presses Enter or the line has been filled */
+    while (term->kbd_commit == term->kbd_tail)
+    {
+        if (get_process()->fds[fd].flags & FILE_NONBLOCK)
+        {
+            restore_flags(flags);
+            return -EAGAIN;
+        }
+        if (signal_pending())
+        {
+            term->read_ack = 0;
+            restore_flags(flags);
+            return -1;
+        }
+        term->read_ack = 1;
+        wait_on(&term->input_wq);
+    }
+
+    term->read_ack = 0;
+
+    /* interrupts stay off until the tail is stored, so another thread of
+       the process can not consume the same line */
+    tail = term->kbd_tail;
+    commit = term->kbd_commit;
+
+    for (i = 0; i < nbytes && tail != commit; )
+    {
+        c = term->kbd_ring[tail & KBD_RING_MASK];
+        ((uint8_t *)buf)[i++] = c;
+        tail++;
+        if (raw)
+            continue;
+        if (c == '\n' || c == CTRL_L || c == CTRL_A || c == CTRL_C)
+            break;
+    }
 
-    return size;
+    term->kbd_tail = tail;
+    restore_flags(flags);
+
+    return i;
 }
 
 
@@ -403,14 +524,22 @@ check_modifier_keys(uint8_t scan1, uint8_t scan2)
 int32_t
 check_function_keys(uint8_t scan1)
 {
+    int32_t term_num = -1;
+
     if(l_alt || r_alt)
     {
-        if (scan1 >= FUNCTION_1 && scan1 <= FUNCTION_3)
+        /* F11 and F12 do not follow F10 in scan code set 1 */
+        if (scan1 >= FUNCTION_1 && scan1 <= FUNCTION_10)
+            term_num = scan1 - FUNCTION_1;
+        else if (scan1 == FUNCTION_11 || scan1 == FUNCTION_12)
+            term_num = 10 + scan1 - FUNCTION_11;
+
+        if (term_num >= 0)
         {
             send_eoi(KEYBOARD_IRQ);
             enable_irq(KEYBOARD_IRQ);
             /* switch the terminal */
-            switch_active_terminal(scan1 - FUNCTION_1);
+            switch_active_terminal(term_num);
 
             return 1;
         }
@@ -421,43 +550,65 @@ check_function_keys(uint8_t scan1)
 }
 
 
+/*
+ * check_scroll_keys
+ *   DESCRIPTION: Checks if SHIFT-PGUP or SHIFT-PGDN is being pressed, and
+ *                moves the visible terminal's scrollback view by a page
+ *   INPUTS: scan1 - the keyboard scan value
+ *   OUTPUTS: none
+ *   RETURN VALUE: int32_t - 1 if detected, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+check_scroll_keys(uint8_t scan1)
+{
+    if(l_shift || r_shift)
+    {
+        if (scan1 == PAGE_UP)
+        {
+            terminal_view_scroll(NUM_ROWS - 1);
+            return 1;
+        }
+        if (scan1 == PAGE_DOWN)
+        {
+            terminal_view_scroll(-(NUM_ROWS - 1));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
 /*
  * check_control_codes
- *   DESCRIPTION: Updates the buffer if any control codes have been detected.
- *                Currently supports - CTRL-A, CTRL-C, CTRL-L
+ *   DESCRIPTION: Queues a control code as its own line of input if one has
+ *                been typed. Currently supports - CTRL-A, CTRL-C, CTRL-L
  *   INPUTS: scan1 - the scan code received from the keyboard
  *   OUTPUTS: none
  *   RETURN VALUE: 1 if CTRL is pressed, 0 otherwise
- *   SIDE EFFECTS: modifies the buffer
+ *   SIDE EFFECTS: discards the line being typed
  */
 int32_t
 check_control_codes(uint8_t scan1)
 {
+    uint8_t code = 0;
+
     if(l_ctrl || r_ctrl)
     {
         if(scan1 == SCAN_L)
-        {
-            memset(active_term()->buffer, '\0', MAX_BUFFER_SIZE);
-            active_term()->buffer_size = 0;
-            active_term()->buffer[active_term()->buffer_size] = CTRL_L;
-            active_term()->ack = 1;
-            active_term()->buffer_size = 1;
-        }
+            code = CTRL_L;
         else if(scan1 == SCAN_A)
-        {
-            memset(active_term()->buffer, '\0', MAX_BUFFER_SIZE);
-            active_term()->buffer_size = 0;
-            active_term()->buffer[active_term()->buffer_size] = CTRL_A;
-            active_term()->ack = 1;
-            active_term()->buffer_size = 1;
-        }
+            code = CTRL_A;
         else if(scan1 == SCAN_C)
+            code = CTRL_C;
+
+        /* the code replaces the line being typed and is read on its own */
+        if (code != 0)
         {
-            memset(active_term()->buffer, '\0', MAX_BUFFER_SIZE);
-            active_term()->buffer_size = 0;
-            active_term()->buffer[active_term()->buffer_size] = CTRL_C;
-            active_term()->ack = 1;
-            active_term()->buffer_size = 1;
+            active_term()->kbd_head = active_term()->kbd_commit;
+            if (kbd_put(code))
+                input_ready();
         }
 
         /* return 1 if any CTRL key is pressed */
@@ -469,18 +620,17 @@ check_control_codes(uint8_t scan1)
 
 
 /*
- * print_character
+ * translate_key
  *   DESCRIPTION: Converts the given scan code to its corresponding ASCII based
  *                on the values of the modifier flags
  *   INPUTS: scan1 - the scan code received from the keyboard
  *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: Puts the character in the input buffer and on the screen
+ *   RETURN VALUE: the character, 0 if the key has none
+ *   SIDE EFFECTS: none
  */
-void
-print_character(uint8_t scan1)
+static uint8_t
+translate_key(uint8_t scan1)
 {
-    /* The following implementation is to handle other keys and cases */
     uint8_t output = scan_code_1[0][scan1];
 
     if(caps ^ (l_shift || r_shift))
@@ -496,19 +646,95 @@ print_character(uint8_t scan1)
             output = scan_code_1[1][scan1];
     }
 
+    return output;
+}
+
+
+/*
+ * check_raw_mode
+ *   DESCRIPTION: If the active terminal's program has its stdin in raw mode,
+ *                queues the key's bytes and makes them readable right away.
+ *                Nothing is echoed and no control key is interpreted; the
+ *                arrow keys are sent as VT100 escape sequences.
+ *   INPUTS: scan1 - the scan code received from the keyboard
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the terminal is in raw mode, 0 otherwise
+ *   SIDE EFFECTS: Wakes up the threads reading the terminal
+ */
+int32_t
+check_raw_mode(uint8_t scan1)
+{
+    terminal_t * term = active_term();
+    uint8_t output;
+
+    if (term->num_procs == 0 ||
+        !(term->child_procs[term->num_procs - 1]->fds[STDIN].flags & FILE_RAW))
+        return 0;
+
+    /* key releases and unknown keys produce nothing */
+    if ((scan1 & RELEASED_MASK) || scan1 >= SUPPORTED_KEYS)
+        return 1;
+
+    if (scan1 == CURSOR_UP || scan1 == CURSOR_DOWN ||
+        scan1 == CURSOR_RIGHT || scan1 == CURSOR_LEFT)
+    {
+        /* only queue whole sequences */
+        if (term->kbd_head - term->kbd_tail > KBD_RING_SIZE - 3)
+            return 1;
+        kbd_put(ANSI_ESC);
+        kbd_put('[');
+        if (scan1 == CURSOR_UP)
+            kbd_put('A');
+        else if (scan1 == CURSOR_DOWN)
+            kbd_put('B');
+        else if (scan1 == CURSOR_RIGHT)
+            kbd_put('C');
+        else
+            kbd_put('D');
+    }
+    else if (scan1 == ENTER_KEYCODE)
+        kbd_put('\n');
+    else if (scan1 == BACKSPACE)
+        kbd_put(ASCII_BACKSPACE);
+    else
+    {
+        output = translate_key(scan1);
+        if (output == 0)
+            return 1;
+        if ((l_ctrl || r_ctrl) && output >= '@')
+            output &= CTRL_MASK;
+        kbd_put(output);
+    }
+
+    input_ready();
+    return 1;
+}
+
+
+/*
+ * print_character
+ *   DESCRIPTION: Converts the given scan code to its corresponding ASCII based
+ *                on the values of the modifier flags
+ *   INPUTS: scan1 - the scan code received from the keyboard
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Puts the character in the input ring and on the screen
+ */
+void
+print_character(uint8_t scan1)
+{
+    /* The following implementation is to handle other keys and cases */
+    uint8_t output = translate_key(scan1);
+
     if(scan1 == SCAN_TAB)
     {
-        if (active_term()->buffer_size + 4 < MAX_BUFFER_SIZE - 2)
+        if (kbd_line_length() + 4 < MAX_BUFFER_SIZE - 2)
         {
             int i;
             for (i = 0; i < 4; i++)
             {
-                if (active_term()->read_ack)
-                {
-                    active_term()->buffer[active_term()->buffer_size] = ' ';
-                    active_term()->buffer_size++;
-                }
-                putc(' ');
+                if (kbd_put(' '))
+                    putc(' ');
             }
         }
     }
@@ -516,11 +742,7 @@ print_character(uint8_t scan1)
             scan1 == CURSOR_LEFT || scan1 == CURSOR_DOWN);
     else
     {
-        if (active_term()->read_ack)
-        {
-            active_term()->buffer[active_term()->buffer_size] = output;
-            active_term()->buffer_size++;
-        }
-        putc(output);
+        if (kbd_put(output))
+            putc(output);
     }
 }
@@ -8,8 +8,14 @@
 #include "x86/i8259.h"
 #include "lib.h"
 #include "types.h"
+#include "process.h"
+#include "signal.h"
 
-static volatile int rtc_interrupt_occurred = 0;
+/* Number of RTC interrupts so far. Each RTC file descriptor keeps the count
+   it last read in its pos field. */
+static volatile uint32_t rtc_ticks = 0;
+/* Threads waiting for the next RTC interrupt */
+static wait_queue_t rtc_wait_queue = 0;
 
 /*
  * rtc_init
@@ -25,8 +31,6 @@ rtc_init(void)
 {
     char prev_saved;
 
-    rtc_interrupt_occurred = 0;
-
     /* Select register B */
     outb(STATUS_REG_B, RTC_PORT1);
 
@@ -56,7 +60,7 @@ rtc_init(void)
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Calls test_interrupts()
+ *   SIDE EFFECTS: Wakes up the threads waiting for the interrupt
  */
 void
 rtc_interrupt_handler(void)
@@ -64,7 +68,8 @@ rtc_interrupt_handler(void)
     disable_irq(RTC_IRQ);
 
     /* acknowledge the interrupt */
-    rtc_interrupt_occurred = 1;
+    rtc_ticks++;
+    wake_up(&rtc_wait_queue);
 
     /* this is to ensure Register C is read after IRQ 8 */
     outb(STATUS_REG_C, RTC_PORT1);
@@ -77,27 +82,76 @@ rtc_interrupt_handler(void)
 
 /*
  * rtc_read
- *   DESCRIPTION: Waits until an interrupt has occured.
- *   INPUTS: fd     - ignored
+ *   DESCRIPTION: Sleeps until an interrupt has occured since the previous read
+ *                on this file descriptor (or since the first read)
+ *   INPUTS: fd     - the RTC file descriptor
  *           buf    - ignored
  *           nbytes - ignored
  *   OUTPUTS: none
  *   RETURN VALUE: 0
+ *                 -EAGAIN - no interrupt yet and fd is non-blocking
+ *                 -1 - interrupted by a signal
  *   SIDE EFFECTS: none
  */
 int32_t
 rtc_read(int32_t fd, void* buf, int32_t nbytes)
 {
-    rtc_interrupt_occurred = 0;
+    file_desc_t * file = &get_process()->fds[fd];
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    /* the first read waits for the next interrupt */
+    if (file->pos == 0)
+        file->pos = rtc_ticks;
+
+    /* sleep while interrupt has not occurred */
+    while (file->pos == rtc_ticks)
+    {
+        if (file->flags & FILE_NONBLOCK)
+        {
+            restore_flags(flags);
+            return -EAGAIN;
+        }
+        if (signal_pending())
+        {
+            restore_flags(flags);
+            return -1;
+        }
+        wait_on(&rtc_wait_queue);
+    }
 
-    /* spin while interrupt has not occurred */
-    while(!rtc_interrupt_occurred);
+    file->pos = rtc_ticks;
 
-    rtc_interrupt_occurred = 0;
+    restore_flags(flags);
     return 0;
 }
 
 
+/*
+ * rtc_poll
+ *   DESCRIPTION: Checks if rtc_read would return without sleeping
+ *   INPUTS: fd - the RTC file descriptor
+ *           wq - set to the wait queue woken on every RTC interrupt
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN if an interrupt occured since the previous read,
+ *                 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+rtc_poll(int32_t fd, uint32_t ** wq)
+{
+    file_desc_t * file = &get_process()->fds[fd];
+
+    *wq = &rtc_wait_queue;
+
+    if (file->pos == 0)
+        file->pos = rtc_ticks;
+
+    return (file->pos != rtc_ticks) ? POLLIN : 0;
+}
+
+
 /*
  * rtc_write
  *   DESCRIPTION: Updates the frequency of the RTC interrupts
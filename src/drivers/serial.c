@@ -0,0 +1,325 @@
+/*
+ * serial.c
+ * Interrupt-driven driver for the 16550 UART on COM1. Writers only copy into
+ * the TX ring; the IRQ handler moves it into the UART's FIFO 16 bytes at a
+ * time, so nobody spins on the line status register.
+ */
+
+#include "drivers/serial.h"
+#include "x86/i8259.h"
+#include "lib.h"
+#include "process.h"
+#include "signal.h"
+
+static uint8_t serial_present = 0;
+
+/* Free-running ring indices, masked on access */
+static uint8_t tx_ring[SERIAL_TX_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+static uint8_t rx_ring[SERIAL_RX_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+/* Threads waiting for received bytes or room in the TX ring */
+static wait_queue_t serial_wait_queue = 0;
+
+
+/*
+ * serial_init
+ *   DESCRIPTION: Sets COM1 to 115200 baud 8N1 with the FIFOs enabled and
+ *                interrupts on received data. Does nothing if there is no
+ *                UART.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Enables the serial IRQ num in PIC
+ */
+void
+serial_init(void)
+{
+    /* a missing UART does not keep what is written to the scratch register */
+    outb(UART_SCRATCH_TEST, COM1_PORT + UART_SCRATCH);
+    if (inb(COM1_PORT + UART_SCRATCH) != UART_SCRATCH_TEST)
+        return;
+
+    outb(0, COM1_PORT + UART_IER);
+
+    outb(UART_LCR_DLAB, COM1_PORT + UART_LCR);
+    outb(UART_DIVISOR & 0xFF, COM1_PORT + UART_DATA);
+    outb(UART_DIVISOR >> 8, COM1_PORT + UART_IER);
+    outb(UART_LCR_8N1, COM1_PORT + UART_LCR);
+
+    outb(UART_FCR_SETUP, COM1_PORT + UART_FCR);
+    outb(UART_MCR_SETUP, COM1_PORT + UART_MCR);
+    outb(UART_IER_RX, COM1_PORT + UART_IER);
+
+    serial_present = 1;
+    enable_irq(SERIAL_IRQ);
+}
+
+
+/*
+ * serial_interrupt_handler
+ *   DESCRIPTION: Handles every pending UART interrupt. Received bytes go into
+ *                the RX ring, and the TX FIFO is refilled from the TX ring.
+ *                The TX interrupt is turned off once the ring is empty.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Wakes up the threads waiting on the serial port
+ */
+void
+serial_interrupt_handler(void)
+{
+    uint8_t iir, c;
+    int i;
+
+    disable_irq(SERIAL_IRQ);
+
+    while (!((iir = inb(COM1_PORT + UART_IIR)) & UART_IIR_NONE))
+    {
+        switch (iir & UART_IIR_ID_MASK)
+        {
+            case UART_IIR_RX:
+            case UART_IIR_RX_TIMEOUT:
+                while (inb(COM1_PORT + UART_LSR) & UART_LSR_DATA)
+                {
+                    c = inb(COM1_PORT + UART_DATA);
+                    /* drop the byte if nobody has been reading */
+                    if (rx_head - rx_tail < SERIAL_RX_SIZE)
+                        rx_ring[rx_head++ & (SERIAL_RX_SIZE - 1)] = c;
+                }
+                break;
+
+            case UART_IIR_TX:
+                for (i = 0; i < UART_FIFO_SIZE && tx_tail != tx_head; i++)
+                    outb(tx_ring[tx_tail++ & (SERIAL_TX_SIZE - 1)],
+                         COM1_PORT + UART_DATA);
+                if (tx_tail == tx_head)
+                    outb(UART_IER_RX, COM1_PORT + UART_IER);
+                break;
+
+            case UART_IIR_LSR:
+                inb(COM1_PORT + UART_LSR);
+                break;
+
+            default:
+                inb(COM1_PORT + UART_MSR);
+                break;
+        }
+    }
+
+    wake_up(&serial_wait_queue);
+
+    send_eoi(SERIAL_IRQ);
+    enable_irq(SERIAL_IRQ);
+}
+
+
+/*
+ * serial_output
+ *   DESCRIPTION: Copies as much of a buffer as fits into the TX ring and
+ *                makes sure the TX interrupt is on to send it. Never waits.
+ *   INPUTS: buf - the bytes to send
+ *           nbytes - number of bytes in buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of bytes queued
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+serial_output(const uint8_t * buf, uint32_t nbytes)
+{
+    uint32_t flags, i;
+
+    if (!serial_present)
+        return 0;
+
+    cli_and_save(flags);
+
+    for (i = 0; i < nbytes && tx_head - tx_tail < SERIAL_TX_SIZE; i++)
+        tx_ring[tx_head++ & (SERIAL_TX_SIZE - 1)] = buf[i];
+
+    /* the UART raises the TX interrupt right away if its FIFO is empty */
+    if (i > 0)
+        outb(UART_IER_RX | UART_IER_TX, COM1_PORT + UART_IER);
+
+    restore_flags(flags);
+    return i;
+}
+
+
+/*
+ * serial_mirror
+ *   DESCRIPTION: Copies a terminal's output to COM1 if it is the mirrored
+ *                terminal. Output that does not fit in the TX ring is lost,
+ *                so the terminal is never slowed down by the serial line.
+ *   INPUTS: term_num - the terminal that was written
+ *           buf - the bytes written
+ *           nbytes - number of bytes in buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+serial_mirror(uint32_t term_num, const void * buf, int32_t nbytes)
+{
+    if (SERIAL_MIRROR_TERM >= 0 && term_num == SERIAL_MIRROR_TERM &&
+        nbytes > 0)
+        serial_output(buf, nbytes);
+}
+
+
+/*
+ * serial_read
+ *   DESCRIPTION: Reads the bytes received on COM1, sleeping until there is at
+ *                least one
+ *   INPUTS: fd     - the serial file descriptor
+ *           buf    - the destination buffer
+ *           nbytes - size of buf
+ *   OUTPUTS: buf
+ *   RETURN VALUE: number of bytes read
+ *                 -EAGAIN - nothing received and fd is non-blocking
+ *                 -1 - no UART, or interrupted by a signal
+ *   SIDE EFFECTS: none
+ */
+int32_t
+serial_read(int32_t fd, void* buf, int32_t nbytes)
+{
+    uint32_t flags;
+    int32_t i;
+
+    if (!serial_present || nbytes < 0)
+        return -1;
+
+    cli_and_save(flags);
+
+    while (rx_head == rx_tail)
+    {
+        if (get_process()->fds[fd].flags & FILE_NONBLOCK)
+        {
+            restore_flags(flags);
+            return -EAGAIN;
+        }
+        if (signal_pending())
+        {
+            restore_flags(flags);
+            return -1;
+        }
+        wait_on(&serial_wait_queue);
+    }
+
+    for (i = 0; i < nbytes && rx_tail != rx_head; i++)
+        ((uint8_t *)buf)[i] = rx_ring[rx_tail++ & (SERIAL_RX_SIZE - 1)];
+
+    restore_flags(flags);
+    return i;
+}
+
+
+/*
+ * serial_write
+ *   DESCRIPTION: Queues a buffer to be sent on COM1, sleeping while the TX
+ *                ring is full
+ *   INPUTS: fd     - the serial file descriptor
+ *           buf    - the bytes to send
+ *           nbytes - number of bytes in buf
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes queued, less than nbytes if fd is
+ *                 non-blocking or a signal arrived
+ *                 -EAGAIN - nothing fit and fd is non-blocking
+ *                 -1 - no UART, or interrupted before anything was queued
+ *   SIDE EFFECTS: none
+ */
+int32_t
+serial_write(int32_t fd, const void* buf, int32_t nbytes)
+{
+    uint32_t flags;
+    int32_t done = 0;
+
+    if (!serial_present || nbytes < 0)
+        return -1;
+
+    cli_and_save(flags);
+
+    while (1)
+    {
+        done += serial_output((const uint8_t *)buf + done, nbytes - done);
+        if (done == nbytes)
+            break;
+
+        if (get_process()->fds[fd].flags & FILE_NONBLOCK)
+        {
+            restore_flags(flags);
+            return done ? done : -EAGAIN;
+        }
+        if (signal_pending())
+        {
+            restore_flags(flags);
+            return done ? done : -1;
+        }
+        wait_on(&serial_wait_queue);
+    }
+
+    restore_flags(flags);
+    return done;
+}
+
+
+/*
+ * serial_open
+ *   DESCRIPTION: Opens the serial port
+ *   INPUTS: filename - ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - success
+ *                 -1 - there is no UART
+ *   SIDE EFFECTS: none
+ */
+int32_t
+serial_open(const uint8_t* filename)
+{
+    return serial_present ? 0 : -1;
+}
+
+
+/*
+ * serial_close
+ *   DESCRIPTION: Does nothing, queued output is still sent
+ *   INPUTS: fd - ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+int32_t
+serial_close(int32_t fd)
+{
+    return 0;
+}
+
+
+/*
+ * serial_poll
+ *   DESCRIPTION: Checks if the serial port can be read or written without
+ *                sleeping
+ *   INPUTS: fd - the serial file descriptor
+ *           wq - set to the wait queue woken on every UART interrupt
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN if bytes were received, POLLOUT if the TX ring has
+ *                 room
+ *   SIDE EFFECTS: none
+ */
+int32_t
+serial_poll(int32_t fd, uint32_t ** wq)
+{
+    int32_t events = 0;
+
+    *wq = &serial_wait_queue;
+
+    if (rx_head != rx_tail)
+        events |= POLLIN;
+    if (tx_head - tx_tail < SERIAL_TX_SIZE)
+        events |= POLLOUT;
+
+    return events;
+}
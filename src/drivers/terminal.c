@@ -7,66 +7,441 @@
 #include "drivers/terminal.h"
 #include "lib.h"
 #include "paging.h"
+#include "frames.h"
 #include "process.h"
 #include "syscalls/syscalls.h"
 #include "drivers/keyboard.h"
+#include "drivers/serial.h"
 #include "x86/i8259.h"
 
 
 static volatile uint8_t curr_terminal = 0;
-static terminal_t terminals[MAX_TERMINALS];
+/* created terminals, NULL until first switched to */
+static terminal_t * terminals[MAX_TERMINALS];
+/* terminal 0 is created before paging, so its memory cannot be frames */
+static uint8_t boot_term_mem[TERM_MEM_PAGES][_4KB]
+                                __attribute__((aligned(PAGE_ALIGN)));
+/* bit i is set while terminal i has processes */
+static uint32_t live_terms = 0;
 
-static const uint8_t attribs[MAX_TERMINALS] = {0x9F, 0x5F, 0x4F};
+static const uint8_t attribs[MAX_TERMINALS] = {
+    0x9F, 0x5F, 0x4F, 0x2F, 0x1F, 0x3F, 0x6F, 0x8F, 0xAF, 0xBF, 0xCF, 0xDF
+};
+
+/* the terminal using each VGA slot, and a count of terminal switches used
+   to find the least recently shown one */
+static terminal_t * vga_slots[TERM_VGA_SLOTS];
+static uint32_t show_count = 0;
+
+/* number of lines the visible terminal is scrolled back into its history */
+static uint32_t view_lines = 0;
+
+
+/*
+ * display_term
+ *   DESCRIPTION: Points the VGA display start address at a terminal's screen,
+ *                leaving any scrollback view
+ *   INPUTS: term - the terminal to show
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the visible part of video memory
+ */
+static void
+display_term(terminal_t * term)
+{
+    view_lines = 0;
+    set_display_start((TERM_SCREEN(term) - (uint8_t *)VIDEO_MEM_START) / 2);
+}
+
+
+/*
+ * has_vidmap
+ *   DESCRIPTION: Checks if the terminal's running process has mapped the
+ *                screen with vidmap, which expects it at the region's start
+ *   INPUTS: term - the terminal to check
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the screen is mapped, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+has_vidmap(terminal_t * term)
+{
+    return term->num_procs > 0 &&
+           term->child_procs[term->num_procs - 1]->vidmem_virt_addr != 0;
+}
+
+
+/*
+ * remap_vidmap
+ *   DESCRIPTION: Points the vidmap page of every process on the terminal at
+ *                the terminal's screen after it moved
+ *   INPUTS: term - the terminal whose screen moved
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes page mappings
+ */
+static void
+remap_vidmap(terminal_t * term)
+{
+    pcb_t * pcb;
+    uint32_t i;
+
+    for (i = 0; i < term->num_procs; i++)
+    {
+        pcb = term->child_procs[i];
+        if (pcb->vidmem_virt_addr == 0)
+            continue;
+
+        set_vidmem_pte(&pcb->vidmem_pte, (uint32_t)term->vidmem);
+        map_proc_page(pcb->pid, pcb->vidmem_virt_addr, pcb->vidmem_pte);
+    }
+}
+
+
+/*
+ * create_term
+ *   DESCRIPTION: Sets up a terminal the first time it is used. Terminal 0
+ *                uses the boot terminal memory, the others take zeroed
+ *                frames for their pages.
+ *   INPUTS: term_num - the terminal number
+ *   OUTPUTS: none
+ *   RETURN VALUE: Terminal struct pointer, NULL if there are not enough free
+ *                 frames
+ *   SIDE EFFECTS: none
+ */
+static terminal_t *
+create_term(uint32_t term_num)
+{
+    uint8_t * pages[TERM_MEM_PAGES];
+    terminal_t * term;
+    uint32_t frame;
+    int j;
+
+    for (j = 0; j < TERM_MEM_PAGES; j++)
+    {
+        if (term_num == 0)
+            pages[j] = boot_term_mem[j];
+        else if (0 != (frame = alloc_zeroed_frame()))
+            pages[j] = (uint8_t *)frame;
+        else
+        {
+            while (j-- > 0)
+                free_frame((uint32_t)pages[j]);
+            return NULL;
+        }
+    }
+    term = (terminal_t *)pages[0];
+
+    term->num = term_num;
+    term->x_pos = 0;
+    term->y_pos = 0;
+
+    term->kbd_head = 0;
+    term->kbd_commit = 0;
+    term->kbd_tail = 0;
+
+    term->attrib = attribs[term_num];
+    term->def_attrib = attribs[term_num];
+
+    term->esc_state = ANSI_GROUND;
+    term->esc_nparams = 0;
+    term->scroll_top = 0;
+    term->scroll_bottom = NUM_ROWS - 1;
+
+    term->read_ack = 0;
+    term->input_wq = 0;
+
+    for (j = 0; j < MAX_PROCESSES; j++)
+        term->child_procs[j] = NULL;
+
+    term->num_procs = 0;
+
+    /* the screen starts out in the backup, until the terminal is shown */
+    term->backup = pages[1];
+    term->vidmem = term->backup;
+    term->vga_slot = -1;
+    term->last_shown = 0;
+    term->top_row = 0;
+    for (j = 0; j < NUM_VIDBUFS; j++)
+        term->vidbufs[j] = pages[2 + SCROLLBACK_PAGES + j];
+
+    for (j = 0; j < SCROLLBACK_PAGES; j++)
+        term->sb_pages[j] = (uint16_t (*)[NUM_COLS])pages[2 + j];
+    term->sb_size = SCROLLBACK_LINES;
+    term->sb_head = 0;
+    term->sb_count = 0;
+
+    /* write the color data to the terminal's screen */
+    uint32_t drawval = (attribs[term_num] << 8) | ' ';
+    memset_word(term->vidmem, drawval, NUM_ROWS * NUM_COLS);
+
+    terminals[term_num] = term;
+    return term;
+}
+
+
+/*
+ * make_resident
+ *   DESCRIPTION: Moves a terminal's screen into a VGA slot so it can be shown
+ *                by moving the display start address. If no slot is free, the
+ *                least recently shown terminal gives up its slot and its
+ *                screen is saved to its backup.
+ *   INPUTS: term - the terminal about to be shown
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may copy screens and change vidmap mappings
+ */
+static void
+make_resident(terminal_t * term)
+{
+    terminal_t * old;
+    uint8_t * slot_mem;
+    int32_t i, slot;
+
+    term->last_shown = ++show_count;
+    if (term->vga_slot >= 0)
+        return;
+
+    /* take a free slot, or the least recently shown terminal's */
+    slot = 0;
+    for (i = 0; i < TERM_VGA_SLOTS; i++)
+    {
+        if (vga_slots[i] == NULL)
+        {
+            slot = i;
+            break;
+        }
+        if (vga_slots[i]->last_shown < vga_slots[slot]->last_shown)
+            slot = i;
+    }
+    slot_mem = (uint8_t *)(VIDEO_MEM_START + slot * TERM_VIDMEM_SIZE);
+
+    old = vga_slots[slot];
+    if (old != NULL)
+    {
+        memcpy(old->backup, TERM_SCREEN(old), NUM_ROWS * TERM_ROW_SIZE);
+        old->top_row = 0;
+        old->vidmem = old->backup;
+        old->vga_slot = -1;
+        remap_vidmap(old);
+    }
+
+    memcpy(slot_mem, TERM_SCREEN(term), NUM_ROWS * TERM_ROW_SIZE);
+    term->top_row = 0;
+    term->vidmem = slot_mem;
+    term->vga_slot = slot;
+    vga_slots[slot] = term;
+    remap_vidmap(term);
+}
 
 
 /*
  * terminal_init
- *   DESCRIPTION: Initializes all 3 terminals and the structs. Created backup
- *                memory mappings for each terminal. Then switches to terminal 0.
+ *   DESCRIPTION: Creates terminal 0 and shows it. The other terminals are
+ *                created when they are first switched to.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Terminals are initialized
+ *   SIDE EFFECTS: Terminal 0 is initialized
  */
 void
 terminal_init()
 {
-    int i, j;
-    for (i = 0; i < MAX_TERMINALS; i++)
+    curr_terminal = 0;
+    make_resident(create_term(0));
+    display_term(terminals[0]);
+}
+
+
+/*
+ * scroll_ring
+ *   DESCRIPTION: Scrolls a terminal up by one row without touching the VGA
+ *                registers. The screen moves down one row of its video memory
+ *                ring. When it reaches the end of the ring, the screen is
+ *                copied back to the start of the ring in one move.
+ *   INPUTS: term - the terminal to scroll
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: saves the top row to the scrollback, clears the new
+ *                 bottom row
+ */
+static void
+scroll_ring(terminal_t * term)
+{
+    uint8_t * screen = TERM_SCREEN(term);
+
+    /* save the row leaving the screen into the scrollback ring */
+    memcpy(TERM_SB_LINE(term, term->sb_head), screen, TERM_ROW_SIZE);
+    term->sb_head = (term->sb_head + 1) % term->sb_size;
+    if (term->sb_count < term->sb_size)
+        term->sb_count++;
+
+    if (term->vga_slot >= 0 && term->top_row + NUM_ROWS < TERM_VIDMEM_ROWS &&
+        !has_vidmap(term))
+        term->top_row++;
+    else
     {
-        terminals[i].x_pos = 0;
-        terminals[i].y_pos = 0;
+        /* wrap around, a screen in its backup page, or a vidmap'd screen
+           that must not move */
+        memmove(term->vidmem, screen + TERM_ROW_SIZE,
+                (NUM_ROWS - 1) * TERM_ROW_SIZE);
+        term->top_row = 0;
+    }
 
-        terminals[i].buffer_size = 0;
-        memset(terminals[i].buffer, '\0', MAX_BUFFER_SIZE);
+    memset_word(TERM_SCREEN(term) + (NUM_ROWS - 1) * TERM_ROW_SIZE,
+                (term->attrib << 8) | ' ', NUM_COLS);
+}
 
-        terminals[i].attrib = attribs[i];
 
-        terminals[i].ack = 0;
-        terminals[i].read_ack = 0;
+/*
+ * scroll_region
+ *   DESCRIPTION: Scrolls the rows of a terminal's scroll region up by one.
+ *                Rows outside the region and the scrollback are untouched.
+ *   INPUTS: term - the terminal to scroll
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the region's bottom row
+ */
+static void
+scroll_region(terminal_t * term)
+{
+    uint8_t * top = TERM_SCREEN(term) + term->scroll_top * TERM_ROW_SIZE;
+    uint32_t rows = term->scroll_bottom - term->scroll_top;
 
-        for (j = 0; j < MAX_PROCESSES; j++)
-            terminals[i].child_procs[j] = NULL;
+    memmove(top, top + TERM_ROW_SIZE, rows * TERM_ROW_SIZE);
+    memset_word(top + rows * TERM_ROW_SIZE, (term->attrib << 8) | ' ',
+                NUM_COLS);
+}
 
-        terminals[i].num_procs = 0;
 
-        terminals[i].virt_vidmem_backup =
-                    (uint8_t *)(VID_BKUP_MEM_START_VIRT + (i * _4KB));
-        terminals[i].phys_vidmem_backup =
-                    (VID_BKUP_MEM_START_PHYS + (i * _4KB));
-        /* create mapping for backup video memory pages */
-        map_backup_vidmem((uint32_t)(terminals[i].virt_vidmem_backup),
-                          terminals[i].phys_vidmem_backup);
+/*
+ * terminal_scroll
+ *   DESCRIPTION: Scrolls a terminal up by one row and shows the new screen
+ *                position if the terminal is visible
+ *   INPUTS: term - the terminal to scroll
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears the new bottom row, may change the display start
+ */
+void
+terminal_scroll(terminal_t * term)
+{
+    scroll_ring(term);
+
+    if (term == active_term())
+        display_term(term);
+}
 
-        /* write the color data to the backup memory */
-        uint32_t drawval = (attribs[i] << 8) | ' ';
-        memset_word(terminals[i].virt_vidmem_backup, drawval, _4KB / 2);
+
+/*
+ * terminal_reset_scroll
+ *   DESCRIPTION: Moves a terminal's screen back to the start of its video
+ *                memory, where vidmap expects it
+ *   INPUTS: term - the terminal to reset
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the display start
+ */
+void
+terminal_reset_scroll(terminal_t * term)
+{
+    if (term->top_row == 0)
+        return;
+
+    memmove(term->vidmem, TERM_SCREEN(term), NUM_ROWS * TERM_ROW_SIZE);
+    term->top_row = 0;
+
+    if (term == active_term())
+    {
+        display_term(term);
+        update_cursor(term->x_pos, term->y_pos);
     }
+}
 
-    curr_terminal = 0;
-    /* create mapping for backup video memory pages */
-    map_backup_vidmem((uint32_t)(terminals[0].virt_vidmem_backup),
-                      VIDEO_MEM_START);
+
+/*
+ * terminal_flip
+ *   DESCRIPTION: Presents one of a terminal's off-screen buffers by copying
+ *                it over the screen in one go. If the terminal is visible the
+ *                copy waits for the vertical retrace, so a frame is never
+ *                shown half drawn.
+ *   INPUTS: term - the terminal
+ *           buf - the buffer to present, less than NUM_VIDBUFS
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the terminal's screen
+ */
+void
+terminal_flip(terminal_t * term, uint32_t buf)
+{
+    uint32_t flags;
+
+    /* wait with interrupts on, it can take a whole frame */
+    if (term == active_term())
+        wait_vretrace();
+
+    cli_and_save(flags);
+    memcpy(TERM_SCREEN(term), TERM_VIDBUF(term, buf),
+           NUM_ROWS * TERM_ROW_SIZE);
+    restore_flags(flags);
+}
+
+
+/*
+ * terminal_view_scroll
+ *   DESCRIPTION: Moves the visible terminal's view through its scrollback
+ *                history. The window of history is drawn into spare VGA
+ *                memory and shown there, so the terminal's own screen keeps
+ *                being written as usual. Any output that scrolls the
+ *                terminal returns the view to the bottom.
+ *   INPUTS: lines - the number of lines to go back, negative to go forward
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the visible part of video memory
+ */
+void
+terminal_view_scroll(int32_t lines)
+{
+    terminal_t * term = active_term();
+    uint16_t * view = (uint16_t *)TERM_VIEW_VIDMEM;
+    int32_t target = (int32_t)view_lines + lines;
+    uint32_t i, line;
+
+    if (target > (int32_t)term->sb_count)
+        target = term->sb_count;
+    if (target < 0)
+        target = 0;
+
+    if ((uint32_t)target == view_lines)
+        return;
+
+    if (target == 0)
+    {
+        display_term(term);
+        return;
+    }
+
+    /* the view starts target lines above the screen's top row */
+    for (i = 0; i < NUM_ROWS; i++)
+    {
+        line = term->sb_count - target + i;
+        if (line < term->sb_count)
+        {
+            memcpy(view + i * NUM_COLS,
+                   TERM_SB_LINE(term, (term->sb_head + term->sb_size -
+                                       term->sb_count + line) % term->sb_size),
+                   TERM_ROW_SIZE);
+        }
+        else
+        {
+            memcpy(view + i * NUM_COLS,
+                   TERM_SCREEN(term) + (line - term->sb_count) * TERM_ROW_SIZE,
+                   TERM_ROW_SIZE);
+        }
+    }
+
+    view_lines = target;
+    set_display_start((TERM_VIEW_VIDMEM - VIDEO_MEM_START) / 2);
 }
 
 
@@ -81,7 +456,7 @@ terminal_init()
 terminal_t *
 active_term()
 {
-    return &terminals[curr_terminal];
+    return terminals[curr_terminal];
 }
 
 
@@ -90,7 +465,7 @@ active_term()
  *   DESCRIPTION: Returns the visible terminal's number
  *   INPUTS: none
  *   OUTPUTS: none
- *   RETURN VALUE: uint32_t terminal number (0-2)
+ *   RETURN VALUE: uint32_t terminal number (0-11)
  *   SIDE EFFECTS: none
  */
 uint32_t
@@ -111,16 +486,18 @@ active_term_num()
 terminal_t *
 executing_term()
 {
-    return &terminals[get_exec_term_num()];
+    return terminals[get_exec_term_num()];
 }
 
 
 /*
- * active_term
- *   DESCRIPTION: Returns a pointer to the requested terminal's struct
+ * get_term
+ *   DESCRIPTION: Returns a pointer to the requested terminal's struct,
+ *                creating the terminal if it is used for the first time
  *   INPUTS: term_num - the terminal number
  *   OUTPUTS: none
- *   RETURN VALUE: Terminal struct pointer
+ *   RETURN VALUE: Terminal struct pointer, NULL if there is no memory for
+ *                 a new terminal
  *   SIDE EFFECTS: none
  */
 terminal_t *
@@ -133,16 +510,70 @@ get_term(uint32_t term_num)
         cli();
         while(1);
     }
-    return &terminals[term_num];
+    if (terminals[term_num] == NULL)
+        return create_term(term_num);
+    return terminals[term_num];
+}
+
+
+/*
+ * live_terminals
+ *   DESCRIPTION: Returns the terminals that have processes, for the scheduler
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: bitmask with bit i set if terminal i has processes
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+live_terminals(void)
+{
+    return live_terms;
+}
+
+
+/*
+ * terminal_add_proc
+ *   DESCRIPTION: Pushes a new process onto the terminal's process stack
+ *   INPUTS: term - the terminal
+ *           pcb - the process' pcb
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks the terminal live
+ */
+void
+terminal_add_proc(terminal_t * term, pcb_t * pcb)
+{
+    term->child_procs[term->num_procs] = pcb;
+    term->num_procs++;
+    live_terms |= (1 << term->num);
+}
+
+
+/*
+ * terminal_remove_proc
+ *   DESCRIPTION: Pops the newest process off the terminal's process stack
+ *   INPUTS: term - the terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks the terminal not live if it has no processes left
+ */
+void
+terminal_remove_proc(terminal_t * term)
+{
+    term->num_procs--;
+    term->child_procs[term->num_procs] = NULL;
+    if (term->num_procs == 0)
+        live_terms &= ~(1 << term->num);
 }
 
 
 /*
  * switch_active_terminal
- *   DESCRIPTION: Causes a switch to the requested terminal. It maps the new
- *                terminal's video memory backup and updates the screen with
- *                new data. If there is no process on the new terminal, it
- *                attempts to create a new one (if there is space.)
+ *   DESCRIPTION: Causes a switch to the requested terminal by pointing the
+ *                VGA display start address at the new terminal's screen.
+ *                The terminal is created if it is used for the first time.
+ *                If there is no process on the new terminal, it attempts to
+ *                create a new one (if there is space.)
  *   INPUTS: termn_num - the terminal to switch to
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -151,6 +582,8 @@ get_term(uint32_t term_num)
 void
 switch_active_terminal(uint32_t term_num)
 {
+    terminal_t * term;
+
     cli();
 
     if (term_num >= MAX_TERMINALS)
@@ -171,93 +604,50 @@ switch_active_terminal(uint32_t term_num)
     /* check if there is available PIDs */
     int32_t pid;
     pid = get_available_pid();
-    if (pid < 1 && get_term(term_num)->num_procs == 0)
+    if (pid < 1 && !(live_terms & (1 << term_num)))
     {
         /* no more space available! */
         printf("\nTerminal not available - max processes reached!\n");
-        active_term()->ack = 1;
+        keyboard_end_line();
         sti();
         return;
     }
     else
         free_pid(pid);
 
-    uint32_t term_procs = active_term()->num_procs;
-
-    /* map backup location back to it's corresponding phys addr */
-    map_backup_vidmem(
-        (uint32_t)(active_term()->virt_vidmem_backup),
-        active_term()->phys_vidmem_backup
-    );
-
-    /* backup video memory of current terminal */
-    memcpy(active_term()->virt_vidmem_backup, (void *)VIDEO_MEM_START, _4KB);
-
-    /* if vidmap was created for current terminal, map that to backup */
-    if (active_term()->child_procs[term_procs-1]->vidmem_virt_addr != 0)
+    /* bring the terminal's screen into VGA memory, which needs no copy
+       unless more terminals are in use than there are VGA slots */
+    term = get_term(term_num);
+    if (term == NULL)
     {
-        pte_t pte;
-        memset(&(pte), 0, sizeof(pte_t));
-
-        /* create the video memory page with user access */
-        pte.present = 1;
-        pte.read_write = 1;
-        pte.user_supervisor = 1;
-        pte.base_addr = active_term()->phys_vidmem_backup >> SHIFT_4KB;
-        map_user_video_mem(
-            active_term()->child_procs[term_procs-1]->vidmem_virt_addr, pte);
+        printf("\nTerminal not available - out of memory!\n");
+        keyboard_end_line();
+        sti();
+        return;
     }
+    make_resident(term);
 
     /* change current terminal number */
     curr_terminal = term_num;
     /* WE HAVE SWITCHED!!! */
 
-    /* update terminal processes */
-    term_procs = active_term()->num_procs;
-
-    /* load the new terminal's backed up screen */
-    memcpy((void *)VIDEO_MEM_START, active_term()->virt_vidmem_backup, _4KB);
-
-    /* map backup location of new terminal to 0xB8 */
-    map_backup_vidmem(
-        (uint32_t)(active_term()->virt_vidmem_backup),
-        VIDEO_MEM_START
-    );
+    /* point the CRTC at the new terminal's screen */
+    display_term(active_term());
     update_cursor(active_term()->x_pos, active_term()->y_pos);
-    
+
     /* execute new shell if no process exists in this terminal */
     if (active_term()->num_procs == 0)
     {
-        /* Save current process's stack pointers */
+        /* Save current thread's stack pointers */
         asm volatile (
             "movl %%esp, %0     \n\t"
             "movl %%ebp, %1     \n\t"
-            : "=r" (executing_term()->
-                    child_procs[executing_term()->num_procs-1]->k_esp),
-              "=r" (executing_term()->
-                    child_procs[executing_term()->num_procs-1]->k_ebp)
+            : "=r" (get_pcb()->k_esp), "=r" (get_pcb()->k_ebp)
         );
         set_exec_term_num(active_term_num());
         execute((uint8_t *)"shell");
         return;
     }
-    else
-    {
-        /* if vidmap was created for next terminal process, restore mapping */
-        if (active_term()->child_procs[term_procs-1]->vidmem_virt_addr != 0)
-        {
-            pte_t pte;
-            memset(&(pte), 0, sizeof(pte_t));
-
-            /* create the video memory page with user access */
-            pte.present = 1;
-            pte.read_write = 1;
-            pte.user_supervisor = 1;
-            pte.base_addr = VIDEO_MEM_INDEX;
-            map_user_video_mem(active_term()->
-                            child_procs[term_procs-1]->vidmem_virt_addr, pte);
-        }
-    }
 
     sti();
 }
@@ -309,7 +699,7 @@ terminal_read(int32_t fd, void* buf, int32_t nbytes)
 {
     int32_t bytes_read = keyboard_read(fd, buf, nbytes);
 
-    if (*((int8_t *)buf) == CTRL_L)
+    if (bytes_read > 0 && *((int8_t *)buf) == CTRL_L)
     {
         clear_setpos(0, 0);
         /* clear the command buffer */
@@ -321,30 +711,165 @@ terminal_read(int32_t fd, void* buf, int32_t nbytes)
 }
 
 
+/*
+ * write_sync
+ *   DESCRIPTION: Stores the cursor that terminal_write cached, and shows the
+ *                terminal's screen and cursor if it is visible. Called with
+ *                interrupts off.
+ *   INPUTS: term - the terminal written to
+ *           x, y - the cursor
+ *           scrolled - the screen moved in its video memory ring
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the display start and the cursor
+ */
+static void
+write_sync(terminal_t * term, uint32_t x, uint32_t y, int32_t scrolled)
+{
+    term->x_pos = x;
+    term->y_pos = y;
+
+    if (term == active_term())
+    {
+        if (scrolled)
+            display_term(term);
+        update_cursor(x, y);
+    }
+}
+
+
 /*
  * terminal_write
  *   DESCRIPTION: Writes to screen all characters passed in via
- *                the buf input
+ *                the buf input. Runs of characters are stored straight into
+ *                the current row, and the display start and cursor are only
+ *                updated once a row's worth of bytes has been written.
+ *                VT100/ANSI escape sequences are handed to the parser in
+ *                ansi.c.
  *   INPUTS: fd - unused (1),
  *           buf - buffer to print to screen,
  *           nbytes - number of bytes in buffer
  *   OUTPUTS: none
- *   RETURN VALUE: zero signifying success
+ *   RETURN VALUE: number of bytes written
  *   SIDE EFFECTS: Prints the buffer to the screen
  */
 int32_t
 terminal_write(int32_t fd, const void* buf, int32_t nbytes)
 {
-    disable_irq(KEYBOARD_IRQ);
-
-    int i;
-    for(i = 0; i < nbytes; i++)
+    terminal_t * term = executing_term();
+    const uint8_t * src = buf;
+    uint16_t * row;
+    uint16_t attrib;
+    uint32_t flags, x, y;
+    int32_t i, chunk, scrolled;
+
+    /* the cursor and row are cached below, so no other writer of this
+       terminal (a thread, or the keyboard echo) may run until they are
+       stored back */
+    cli_and_save(flags);
+
+    x = term->x_pos;
+    y = term->y_pos;
+    attrib = term->attrib << 8;
+    row = (uint16_t *)(TERM_SCREEN(term) + y * TERM_ROW_SIZE);
+    scrolled = 0;
+
+    i = 0;
+    chunk = 0;
+    while (i < nbytes)
     {
-        putc_buffer(*(uint8_t*)buf);
-        buf++;
+        /* let interrupts in after every row's worth of bytes, so a large
+           write does not hold off the PIT and the input devices */
+        if (i - chunk >= NUM_COLS)
+        {
+            write_sync(term, x, y, scrolled);
+            restore_flags(flags);
+            cli_and_save(flags);
+
+            x = term->x_pos;
+            y = term->y_pos;
+            attrib = term->attrib << 8;
+            row = (uint16_t *)(TERM_SCREEN(term) + y * TERM_ROW_SIZE);
+            scrolled = 0;
+            chunk = i;
+        }
+
+        /* escape sequences go through the parser, one byte at a time */
+        if (src[i] == ANSI_ESC || term->esc_state != ANSI_GROUND)
+        {
+            term->x_pos = x;
+            term->y_pos = y;
+            ansi_putc(term, src[i++]);
+            x = term->x_pos;
+            y = term->y_pos;
+            attrib = term->attrib << 8;
+            row = (uint16_t *)(TERM_SCREEN(term) + y * TERM_ROW_SIZE);
+            continue;
+        }
+
+        /* store the run of characters up to a newline, an escape or the
+           row's end */
+        while (i < nbytes && x < NUM_COLS && src[i] != '\n' &&
+               src[i] != '\r' && src[i] != ANSI_ESC)
+            row[x++] = attrib | src[i++];
+
+        if (x < NUM_COLS)
+        {
+            if (i == nbytes || src[i] == ANSI_ESC)
+                continue;
+            /* skip the newline character */
+            i++;
+        }
+
+        /* move to the next line, scrolling at the bottom of the region */
+        x = 0;
+        if (y == term->scroll_bottom)
+        {
+            if (term->scroll_top == 0 && term->scroll_bottom == NUM_ROWS - 1)
+            {
+                scroll_ring(term);
+                scrolled = 1;
+            }
+            else
+                scroll_region(term);
+        }
+        else if (y < NUM_ROWS - 1)
+            y++;
+        row = (uint16_t *)(TERM_SCREEN(term) + y * TERM_ROW_SIZE);
     }
 
-    enable_irq(KEYBOARD_IRQ);
+    write_sync(term, x, y, scrolled);
+    restore_flags(flags);
+
+    serial_mirror(get_exec_term_num(), buf, nbytes);
 
     return nbytes;
 }
+
+
+/*
+ * terminal_poll
+ *   DESCRIPTION: Checks if the terminal can be read or written without
+ *                sleeping
+ *   INPUTS: fd - STDIN or STDOUT
+ *           wq - set to the wait queue woken when a line is complete
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN if a line of input is complete (stdin),
+ *                 POLLOUT (stdout)
+ *   SIDE EFFECTS: none
+ */
+int32_t
+terminal_poll(int32_t fd, uint32_t ** wq)
+{
+    terminal_t * term = executing_term();
+
+    if (fd != STDIN)
+    {
+        *wq = NULL;
+        return POLLOUT;
+    }
+
+    *wq = &term->input_wq;
+
+    return (term->kbd_commit != term->kbd_tail) ? POLLIN : 0;
+}
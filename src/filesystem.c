@@ -123,6 +123,43 @@ get_elf_entrypoint(uint32_t inode)
 }
 
 
+/*
+ * get_elf_image_end
+ *   DESCRIPTION: Finds where the program's loaded segments end in memory,
+ *                including zero-filled data past the end of the file
+ *   INPUTS: The inode number of the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: the virtual address past the last segment, 0 if the file
+ *                 has no readable program headers
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+get_elf_image_end(uint32_t inode)
+{
+    uint32_t phoff, end = 0;
+    uint16_t phnum, i;
+    elf_phdr_t phdr;
+
+    if (sizeof(uint32_t) != read_data(inode, PHOFF_OFFSET,
+                                      (void*)&phoff, sizeof(uint32_t)) ||
+        sizeof(uint16_t) != read_data(inode, PHNUM_OFFSET,
+                                      (void*)&phnum, sizeof(uint16_t)))
+        return 0;
+
+    for (i = 0; i < phnum; i++)
+    {
+        if (sizeof(elf_phdr_t) != read_data(inode,
+                                            phoff + i * sizeof(elf_phdr_t),
+                                            (void*)&phdr, sizeof(elf_phdr_t)))
+            return 0;
+        if (phdr.type == ELF_PT_LOAD && phdr.vaddr + phdr.memsz > end)
+            end = phdr.vaddr + phdr.memsz;
+    }
+
+    return end;
+}
+
+
 /*
  * fs_open
  *   DESCRIPTION: Checks if the file exists in the filesystem
@@ -168,7 +205,7 @@ fs_close(int32_t fd)
 int32_t
 fs_read(int32_t fd, void* buf, int32_t nbytes)
 {
-    file_desc_t fd_file = get_pcb()->fds[fd];
+    file_desc_t fd_file = get_process()->fds[fd];
 
     /* read directory */
     if (((fd_file.flags & FILE_TYPE_MASK) >> 1) == DIR_FILE_TYPE)
@@ -177,7 +214,7 @@ fs_read(int32_t fd, void* buf, int32_t nbytes)
         if (!read_dentry_by_index(fd_file.pos, &d))
         {
             /* increment the position in the list of files in directory */
-            get_pcb()->fds[fd].pos++;
+            get_process()->fds[fd].pos++;
             if(nbytes <= FILENAME_SIZE)
             {
                 memcpy(buf, d.filename, nbytes);
@@ -200,7 +237,7 @@ fs_read(int32_t fd, void* buf, int32_t nbytes)
         if(bytes_read == -1)
             return 0;
 
-        get_pcb()->fds[fd].pos += bytes_read;
+        get_process()->fds[fd].pos += bytes_read;
         return bytes_read;
     }
     /* Filetype is broken */
@@ -223,6 +260,23 @@ fs_write(int32_t fd, const void* buf, int32_t nbytes)
 }
 
 
+/*
+ * fs_poll
+ *   DESCRIPTION: Files and directories in memory can always be read
+ *   INPUTS: fd - ignored
+ *           wq - set to NULL, the readiness never changes
+ *   OUTPUTS: none
+ *   RETURN VALUE: POLLIN
+ *   SIDE EFFECTS: none
+ */
+int32_t
+fs_poll(int32_t fd, uint32_t ** wq)
+{
+    *wq = NULL;
+    return POLLIN;
+}
+
+
 /*
  * read_dentry_by_name
  *   DESCRIPTION: Gets the dentry_t object of a file specified by its name
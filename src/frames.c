@@ -0,0 +1,248 @@
+/*
+ * frames.c - Allocator of the physical 4KB frames that back user memory and
+ * user page tables. Free frames are kept on a stack, so allocating and
+ * freeing are both O(1). A small pool of frames is zeroed while the
+ * processor would otherwise idle, so fresh user pages rarely have to be
+ * cleared when they are allocated.
+ */
+
+#include "frames.h"
+#include "swap.h"
+
+static uint32_t free_frames[NUM_FRAMES];
+static uint32_t num_free = 0;
+
+static uint32_t zero_pool[ZERO_POOL_SIZE];
+static uint32_t num_zeroed = 0;
+/* frames taken for the pool and still being zeroed, their slots reserved */
+static uint32_t num_zeroing = 0;
+static uint32_t zero_pool_hits = 0;
+static uint32_t zero_pool_misses = 0;
+
+/* most frames ever allocated at once */
+static uint32_t peak_used = 0;
+
+
+/*
+ * update_peak
+ *   DESCRIPTION: Raises the peak of frames in use after an allocation.
+ *                Called with interrupts off.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+update_peak(void)
+{
+    uint32_t used = NUM_FRAMES - (num_free + num_zeroed + num_zeroing);
+
+    if (used > peak_used)
+        peak_used = used;
+}
+
+
+/*
+ * frames_init
+ *   DESCRIPTION: Puts every frame between FRAMES_START and FRAMES_END on the
+ *                free stack, lowest address on top
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+frames_init(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < NUM_FRAMES; i++)
+        free_frames[i] = FRAMES_END - (i + 1) * _4KB;
+    num_free = NUM_FRAMES;
+}
+
+
+/*
+ * alloc_frame
+ *   DESCRIPTION: Takes a frame off the free stack, or out of the zeroed pool
+ *                once the stack is empty. Its contents are left as they
+ *                were.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the physical address of the frame, 0 if none are free
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+alloc_frame(void)
+{
+    uint32_t flags, frame = 0;
+
+    cli_and_save(flags);
+    if (num_free > 0)
+        frame = free_frames[--num_free];
+    else if (num_zeroed > 0)
+        frame = zero_pool[--num_zeroed];
+    update_peak();
+    restore_flags(flags);
+
+    return frame;
+}
+
+
+/*
+ * alloc_zeroed_frame
+ *   DESCRIPTION: Takes a zeroed frame out of the pool, or zeroes a free one
+ *                if the pool is empty
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the physical address of the frame, 0 if none are free
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+alloc_zeroed_frame(void)
+{
+    uint32_t flags, frame;
+
+    cli_and_save(flags);
+    if (num_zeroed > 0)
+    {
+        frame = zero_pool[--num_zeroed];
+        zero_pool_hits++;
+        update_peak();
+        restore_flags(flags);
+        return frame;
+    }
+    zero_pool_misses++;
+    restore_flags(flags);
+
+    if (0 != (frame = alloc_frame()))
+        memset((void *)frame, 0, _4KB);
+    return frame;
+}
+
+
+/*
+ * free_frame
+ *   DESCRIPTION: Gives a frame back to the free stack
+ *   INPUTS: phys_addr - the physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+free_frame(uint32_t phys_addr)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    free_frames[num_free++] = phys_addr;
+    restore_flags(flags);
+}
+
+
+/*
+ * free_frame_count
+ *   DESCRIPTION: Returns the number of frames that can still be allocated
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of free frames
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+free_frame_count(void)
+{
+    return num_free + num_zeroed + num_zeroing;
+}
+
+
+/*
+ * zero_pool_refill
+ *   DESCRIPTION: Zeroes one free frame and adds it to the pool. Called with
+ *                interrupts off from the idle loop; they are turned on while
+ *                the frame is cleared, so its pool slot is reserved first.
+ *                Another thread can refill in the meantime, or kill the
+ *                caller, so the frame is recorded in in_flight until it is
+ *                in the pool.
+ *   INPUTS: in_flight - where the caller keeps the frame being zeroed
+ *   OUTPUTS: in_flight
+ *   RETURN VALUE: 1 if a frame was added, 0 if the pool is full or there are
+ *                 no free frames
+ *   SIDE EFFECTS: Enables interrupts for a moment
+ */
+int32_t
+zero_pool_refill(uint32_t * in_flight)
+{
+    uint32_t frame;
+
+    if (num_zeroed + num_zeroing >= ZERO_POOL_SIZE || num_free == 0)
+        return 0;
+    frame = free_frames[--num_free];
+    num_zeroing++;
+    *in_flight = frame;
+
+    sti();
+    memset((void *)frame, 0, _4KB);
+    cli();
+
+    *in_flight = 0;
+    num_zeroing--;
+    zero_pool[num_zeroed++] = frame;
+    return 1;
+}
+
+
+/*
+ * zero_pool_cancel
+ *   DESCRIPTION: Gives back the frame a killed thread was zeroing for the
+ *                pool, and the pool slot reserved for it
+ *   INPUTS: in_flight - where the thread kept the frame, 0 if none
+ *   OUTPUTS: in_flight
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+zero_pool_cancel(uint32_t * in_flight)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    if (*in_flight != 0)
+    {
+        free_frames[num_free++] = *in_flight;
+        num_zeroing--;
+        *in_flight = 0;
+    }
+    restore_flags(flags);
+}
+
+
+/*
+ * frame_stats
+ *   DESCRIPTION: Copies the allocator counters to user space
+ *   INPUTS: stats - where to put them
+ *   OUTPUTS: stats
+ *   RETURN VALUE: 0 - success
+ *                 -1 - stats is not in user memory
+ *   SIDE EFFECTS: none
+ */
+int32_t
+frame_stats(frame_stats_t * stats)
+{
+    uint32_t flags;
+
+    if (bad_userspace_addr(stats, sizeof(frame_stats_t)))
+        return -1;
+
+    cli_and_save(flags);
+    stats->total_frames = NUM_FRAMES;
+    stats->free_frames = num_free + num_zeroed + num_zeroing;
+    stats->zeroed_frames = num_zeroed;
+    stats->peak_used_frames = peak_used;
+    stats->swapped_pages = swapped_page_count();
+    stats->swap_frames = swap_frame_count();
+    stats->zero_pool_hits = zero_pool_hits;
+    stats->zero_pool_misses = zero_pool_misses;
+    restore_flags(flags);
+
+    return 0;
+}
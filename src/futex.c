@@ -0,0 +1,144 @@
+/*
+ * futex.c - Fast user-space mutex (futex) syscalls. A user program keeps its
+ * lock word in its own memory and only enters the kernel to sleep on it when
+ * the lock is contended, or to wake up sleepers when it releases it.
+ */
+
+#include "futex.h"
+#include "lib.h"
+#include "paging.h"
+#include "process.h"
+#include "signal.h"
+
+/* Sleeping threads, hashed by the physical address they are waiting on */
+static wait_queue_t futex_queues[FUTEX_HASH_SIZE];
+
+
+/*
+ * futex_wait
+ *   DESCRIPTION: Puts the calling thread to sleep on the futex at addr if it
+ *                still holds the value val. The check and the sleep are atomic
+ *                with respect to futex_wake.
+ *   INPUTS: addr - the user address of the futex word
+ *           val - the value the caller expects the futex word to hold
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - woken up by futex_wake
+ *                 -1 - bad address, the futex word did not hold val, or a
+ *                      signal arrived
+ *   SIDE EFFECTS: Blocks the calling thread
+ */
+int32_t
+futex_wait(uint32_t * addr, uint32_t val)
+{
+    uint32_t flags, key;
+    pcb_t * pcb;
+
+    if (bad_userspace_addr(addr, sizeof(uint32_t)))
+        return -1;
+
+    cli_and_save(flags);
+
+    /* the lock may have been released before we got here */
+    if (*addr != val)
+    {
+        restore_flags(flags);
+        return -1;
+    }
+
+    /* key on the physical address so that any mapping of it matches */
+    key = virt_to_phys((uint32_t)addr);
+
+    pcb = get_pcb();
+    pcb->futex_key = key;
+    wait_on(&futex_queues[FUTEX_HASH(key)]);
+    pcb->futex_key = 0;
+
+    restore_flags(flags);
+
+    /* woken up by a signal rather than by futex_wake */
+    if (signal_pending())
+        return -1;
+    return 0;
+}
+
+
+/*
+ * futex_wake
+ *   DESCRIPTION: Wakes up to n threads sleeping on the futex at addr
+ *   INPUTS: addr - the user address of the futex word
+ *           n - the maximum number of threads to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of threads woken up
+ *                 -1 - bad address
+ *   SIDE EFFECTS: none
+ */
+int32_t
+futex_wake(uint32_t * addr, uint32_t n)
+{
+    uint32_t flags, key, pid, woken;
+    wait_queue_t * wq;
+    pcb_t * pcb;
+
+    if (bad_userspace_addr(addr, sizeof(uint32_t)))
+        return -1;
+
+    cli_and_save(flags);
+
+    key = virt_to_phys((uint32_t)addr);
+    wq = &futex_queues[FUTEX_HASH(key)];
+    woken = 0;
+
+    for (pid = 1; pid <= MAX_PROCESSES && woken < n; pid++)
+    {
+        if (!(*wq & PID_MASK(pid)))
+            continue;
+
+        pcb = get_pcb_by_pid(pid);
+
+        /* drop threads that are no longer sleeping here */
+        if (pcb->state != TASK_BLOCKED || pcb->futex_key == 0)
+        {
+            *wq &= ~PID_MASK(pid);
+            continue;
+        }
+
+        /* other futexes can share the bucket */
+        if (pcb->futex_key != key)
+            continue;
+
+        *wq &= ~PID_MASK(pid);
+        wake_thread(pcb);
+        woken++;
+    }
+
+    restore_flags(flags);
+    return woken;
+}
+
+
+/*
+ * futex_frame_in_use
+ *   DESCRIPTION: Checks if a thread sleeps on a futex in a frame. Such a
+ *                frame must not be swapped out, as the futex key would
+ *                change when it comes back.
+ *   INPUTS: frame - the physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a thread sleeps on it, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+futex_frame_in_use(uint32_t frame)
+{
+    uint32_t pid;
+    pcb_t * pcb;
+
+    for (pid = 1; pid <= MAX_PROCESSES; pid++)
+    {
+        pcb = get_pcb_by_pid(pid);
+        if (pcb->state == TASK_BLOCKED &&
+            (pcb->futex_key & ~(_4KB - 1)) == frame)
+            return 1;
+    }
+
+    return 0;
+}
@@ -7,6 +7,8 @@
 #include "debug.h"
 #include "lib.h"
 #include "paging.h"
+#include "frames.h"
+#include "swap.h"
 #include "filesystem.h"
 #include "process.h"
 #include "x86/i8259.h"
@@ -14,6 +16,7 @@
 #include "drivers/rtc.h"
 #include "drivers/keyboard.h"
 #include "drivers/terminal.h"
+#include "drivers/serial.h"
 #include "syscalls/syscalls.h"
 
 /* Macros. */
@@ -37,7 +40,8 @@ entry (unsigned long magic, unsigned long addr)
 	multiboot_info_t *mbi;
     uint32_t fs_start_addr, fs_end_addr;
 
-	/* Clear the screen. */
+	/* Set up the terminal screens, then clear the visible one. */
+	terminal_init();
 	clear();
 
 	/* Am I booted by a Multiboot-compliant boot loader? */
@@ -176,13 +180,15 @@ entry (unsigned long magic, unsigned long addr)
 
     /* Initializing Paging */
     init_paging();
+    frames_init();
+    swap_init();
 
 	/* Initialize devices, memory, filesystem, enable device interrupts on the
 	 * PIC, any other initialization stuff... */
-    terminal_init();
 	pit_init();
 	rtc_init();
 	keyboard_init();
+	serial_init();
 
 	/* Enable interrupts */
 	/* Do not enable the following until after you have set up your
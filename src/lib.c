@@ -4,6 +4,7 @@
 
 #include "lib.h"
 #include "drivers/terminal.h"
+#include "process.h"
 
 #define VIDEO           0xB8000
 #define NUM_COLS        80
@@ -14,10 +15,29 @@
 #define CURSOR_REG_LOW  0x0F
 #define CURSOR_MASK     0xFF
 #define CURSOR_OFFSET   8
+#define CRTC_START_HIGH 0x0C
+#define CRTC_START_LOW  0x0D
+#define VGA_STATUS_PORT 0x3DA
+#define VGA_VRETRACE    0x08
 
 
 static char* video_mem = (char *)VIDEO;
 
+
+/*
+ * screen_mem
+ *   DESCRIPTION: Returns the visible terminal's screen in video memory
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the visible screen
+ *   SIDE EFFECTS: none
+ */
+static char*
+screen_mem(void)
+{
+    return (char *)TERM_SCREEN(active_term());
+}
+
 /*
 * void clear(void);
 *   Inputs: void
@@ -29,9 +49,10 @@ void
 clear(void)
 {
     int32_t i;
+    char* screen = screen_mem();
     for(i=0; i<NUM_ROWS*NUM_COLS; i++) {
-        *(uint8_t *)(video_mem + (i << 1)) = ' ';
-        *(uint8_t *)(video_mem + (i << 1) + 1) = active_term()->attrib;
+        *(uint8_t *)(screen + (i << 1)) = ' ';
+        *(uint8_t *)(screen + (i << 1) + 1) = active_term()->attrib;
     }
 }
 
@@ -211,25 +232,27 @@ puts(int8_t* s)
 void
 putc(uint8_t c)
 {
+    char* screen = screen_mem();
+
     if(c == '\n' || c == '\r')
     {
         if(active_term()->y_pos == NUM_ROWS - 1)
-            shift_display(video_mem);
+            terminal_scroll(active_term());
         else
             active_term()->y_pos++;
         active_term()->x_pos = 0;
     }
     else
     {
-        *(uint8_t *)(video_mem + ((NUM_COLS*active_term()->y_pos +
+        *(uint8_t *)(screen + ((NUM_COLS*active_term()->y_pos +
                     active_term()->x_pos) << 1)) = c;
-        *(uint8_t *)(video_mem + ((NUM_COLS*active_term()->y_pos +
+        *(uint8_t *)(screen + ((NUM_COLS*active_term()->y_pos +
                     active_term()->x_pos) << 1) + 1) = active_term()->attrib;
         active_term()->x_pos++;
         if(active_term()->x_pos >= NUM_COLS)
         {
             if(active_term()->y_pos == NUM_ROWS - 1) // we are in the last row
-                shift_display(video_mem);
+                terminal_scroll(active_term());
             else
                 active_term()->y_pos++;
             active_term()->x_pos = 0;
@@ -240,85 +263,6 @@ putc(uint8_t c)
 }
 
 
-/*
-* void putc(uint8_t c);
-*   Inputs: uint_8* c = character to print
-*   Return Value: void
-*	Function: Output a character to the console 
-*/
-void
-putc_buffer(uint8_t c)
-{
-    if(c == '\n' || c == '\r')
-    {
-        if(executing_term()->y_pos == NUM_ROWS - 1)
-            shift_display((char*)executing_term()->virt_vidmem_backup);
-        else
-            executing_term()->y_pos++;
-        executing_term()->x_pos = 0;
-    }
-    else
-    {
-        *(uint8_t *)(executing_term()->virt_vidmem_backup +
-                ((NUM_COLS*executing_term()->y_pos +
-                    executing_term()->x_pos) << 1)) = c;
-        *(uint8_t *)(executing_term()->virt_vidmem_backup +
-                ((NUM_COLS*executing_term()->y_pos +
-                    executing_term()->x_pos) << 1) + 1) = executing_term()->attrib;
-        executing_term()->x_pos++;
-        if(executing_term()->x_pos >= NUM_COLS)
-        {
-            if(executing_term()->y_pos == NUM_ROWS - 1) // we are in the last row
-                shift_display((char*)executing_term()->virt_vidmem_backup);
-            else
-                executing_term()->y_pos++;
-            executing_term()->x_pos = 0;
-        }
-    }
-    if(executing_term() == active_term())
-    	update_cursor(executing_term()->x_pos, executing_term()->y_pos);
-}
-
-
-/*
- * shift_display
- *   DESCRIPTION: implements scrolling functionality on
- *                terminal screen by shifting values in
- *                each row of video memory to the row
- *                above
- *   INPUTS: none
- *   OUTPUTS: none
- *   RETURN VALUE: void
- *   SIDE EFFECTS: changes values in video memory
- */
-void
-shift_display(char* write_mem)
-{
-    int j;
-
-    for(j = 1; j < NUM_ROWS; j++)
-    {
-        void * dest = write_mem + ((NUM_COLS * (j - 1)) << 1);
-        void * src  = write_mem + ((NUM_COLS * j) << 1);;
-        memcpy(dest, src, NUM_COLS * 2);
-    }
-
-    for(j = 0; j < NUM_COLS; j++)
-    {
-        *(uint8_t *)(write_mem + ((NUM_COLS*(NUM_ROWS-1) + j) << 1)) = ' ';
-        if (write_mem == video_mem)
-        {
-            *(uint8_t *)(write_mem + ((NUM_COLS*(NUM_ROWS-1) + j) << 1) + 1) =
-                        active_term()->attrib;
-        }
-        else
-        {
-            *(uint8_t *)(write_mem + ((NUM_COLS*(NUM_ROWS-1) + j) << 1) + 1) =
-                        executing_term()->attrib;
-        }
-    }
-}
-
 /*
  * update cursor
  *   DESCRIPTION: updates cursor position on terminal
@@ -333,7 +277,9 @@ shift_display(char* write_mem)
 void
 update_cursor(int col, int row)
 {
-    unsigned short position = (row * NUM_COLS) + col;
+    /* the cursor location is relative to the start of video memory */
+    unsigned short position = ((screen_mem() - video_mem) >> 1) +
+                              (row * NUM_COLS) + col;
 
     // cursor LOW port to vga INDEX register
     outb(CURSOR_REG_LOW, CURSOR_PORT);
@@ -343,6 +289,41 @@ update_cursor(int col, int row)
     outb((unsigned char )((position >> CURSOR_OFFSET) & CURSOR_MASK), CURSOR_PORT + 1);
 }
 
+/*
+ * set_display_start
+ *   DESCRIPTION: Sets the CRTC start address, the first character of video
+ *                memory shown in the top left corner of the screen
+ *   INPUTS: offset - the start address, in characters from 0xB8000
+ *   OUTPUTS: none
+ *   RETURN VALUE: void
+ *   SIDE EFFECTS: changes the visible part of video memory
+ */
+void
+set_display_start(uint32_t offset)
+{
+    outb(CRTC_START_LOW, CURSOR_PORT);
+    outb((unsigned char)(offset & CURSOR_MASK), CURSOR_PORT + 1);
+    outb(CRTC_START_HIGH, CURSOR_PORT);
+    outb((unsigned char)((offset >> CURSOR_OFFSET) & CURSOR_MASK), CURSOR_PORT + 1);
+}
+
+/*
+ * wait_vretrace
+ *   DESCRIPTION: Waits for the start of the next vertical retrace, so video
+ *                memory written right after is not shown half done
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: void
+ *   SIDE EFFECTS: spins for up to one frame
+ */
+void
+wait_vretrace(void)
+{
+    /* let a retrace in progress finish, it may be almost over */
+    while (inb(VGA_STATUS_PORT) & VGA_VRETRACE);
+    while (!(inb(VGA_STATUS_PORT) & VGA_VRETRACE));
+}
+
 /*
  * do_backspace
  *   DESCRIPTION: implements backspace functionality
@@ -729,6 +710,32 @@ strncpy(int8_t* dest, const int8_t* src, uint32_t n)
 	return dest;
 }
 
+/*
+ * bad_userspace_addr
+ *   DESCRIPTION: Checks that a buffer lies entirely within mapped user pages.
+ *                A buffer on the calling thread's stack that it has not
+ *                grown into yet gets mapped.
+ *   INPUTS: addr - start of the buffer
+ *           len - length of the buffer in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 - the buffer is (partly) outside of userspace
+ *                 0 - the buffer is valid
+ *   SIDE EFFECTS: none
+ */
+int32_t
+bad_userspace_addr(const void* addr, int32_t len)
+{
+    if (len < 0 || (uint32_t)addr < USER_MEM_START ||
+        (uint32_t)addr + len > USER_HEAP_END)
+        return 1;
+
+    if (user_range_mapped((uint32_t)addr, len))
+        return 0;
+    if (0 != grow_user_stack((uint32_t)addr, USER_CONTEXT(get_pcb())->esp))
+        return 1;
+    return !user_range_mapped((uint32_t)addr, len);
+}
+
 /*
 * void test_interrupts(void)
 *   Inputs: void
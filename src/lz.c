@@ -0,0 +1,249 @@
+/*
+ * lz.c - A byte-oriented LZ77 codec in the style of LZ4. The output is a
+ * list of sequences: a token byte whose high nibble counts literals and low
+ * nibble the match length, the literals, then a 2 byte offset back to the
+ * match. The last sequence has only literals. Matches are found through a
+ * hash table of the positions of earlier 4 byte sequences, so compressing
+ * is a single pass, and decompressing is just copying.
+ */
+
+#include "lz.h"
+#include "lib.h"
+
+#define LZ_HASH(seq)   (((seq) * 2654435761U) >> (32 - LZ_HASH_BITS))
+
+/* Only used with interrupts off, so one table does for every caller */
+static uint16_t lz_table[LZ_HASH_SIZE];
+
+
+/*
+ * lz_put_length
+ *   DESCRIPTION: Writes the part of a length that did not fit in its token
+ *                nibble, as 255s and a final smaller byte
+ *   INPUTS: dst - the output buffer
+ *           op - the output position, advanced
+ *           cap - the size of dst
+ *           n - the rest of the length
+ *   OUTPUTS: dst, op
+ *   RETURN VALUE: 0 - success
+ *                 -1 - dst is full
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+lz_put_length(uint8_t * dst, uint32_t * op, uint32_t cap, uint32_t n)
+{
+    while (n >= LZ_BYTE_MAX)
+    {
+        if (*op >= cap)
+            return -1;
+        dst[(*op)++] = LZ_BYTE_MAX;
+        n -= LZ_BYTE_MAX;
+    }
+
+    if (*op >= cap)
+        return -1;
+    dst[(*op)++] = n;
+    return 0;
+}
+
+
+/*
+ * lz_get_length
+ *   DESCRIPTION: Reads the extra bytes of a length whose token nibble was
+ *                full
+ *   INPUTS: src - the compressed data
+ *           ip - the input position, advanced
+ *           len - the size of src
+ *           n - where the length is added up
+ *   OUTPUTS: ip, n
+ *   RETURN VALUE: 0 - success
+ *                 -1 - the data ends in the middle of the length
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+lz_get_length(const uint8_t * src, uint32_t * ip, uint32_t len, uint32_t * n)
+{
+    uint8_t b;
+
+    do
+    {
+        if (*ip >= len)
+            return -1;
+        b = src[(*ip)++];
+        *n += b;
+    } while (b == LZ_BYTE_MAX);
+
+    return 0;
+}
+
+
+/*
+ * lz_emit
+ *   DESCRIPTION: Writes a sequence of literals followed by a match
+ *   INPUTS: dst - the output buffer
+ *           op - the output position, advanced
+ *           cap - the size of dst
+ *           lit - the literals
+ *           nlit - the number of literals
+ *           offset - how far back the match starts
+ *           mlen - the match length, 0 for the last sequence
+ *   OUTPUTS: dst, op
+ *   RETURN VALUE: 0 - success
+ *                 -1 - dst is full
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+lz_emit(uint8_t * dst, uint32_t * op, uint32_t cap, const uint8_t * lit,
+        uint32_t nlit, uint32_t offset, uint32_t mlen)
+{
+    uint32_t lit_nibble, match_nibble;
+
+    lit_nibble = (nlit < LZ_NIBBLE_MAX) ? nlit : LZ_NIBBLE_MAX;
+    match_nibble = 0;
+    if (mlen != 0)
+    {
+        mlen -= LZ_MIN_MATCH;
+        match_nibble = (mlen < LZ_NIBBLE_MAX) ? mlen : LZ_NIBBLE_MAX;
+    }
+
+    if (*op >= cap)
+        return -1;
+    dst[(*op)++] = (lit_nibble << 4) | match_nibble;
+
+    if (lit_nibble == LZ_NIBBLE_MAX &&
+        0 != lz_put_length(dst, op, cap, nlit - LZ_NIBBLE_MAX))
+        return -1;
+
+    if (*op + nlit > cap)
+        return -1;
+    memcpy(dst + *op, lit, nlit);
+    *op += nlit;
+
+    if (offset == 0)
+        return 0;
+
+    if (*op + 2 > cap)
+        return -1;
+    dst[(*op)++] = offset & 0xFF;
+    dst[(*op)++] = offset >> 8;
+
+    if (match_nibble == LZ_NIBBLE_MAX &&
+        0 != lz_put_length(dst, op, cap, mlen - LZ_NIBBLE_MAX))
+        return -1;
+
+    return 0;
+}
+
+
+/*
+ * lz_compress
+ *   DESCRIPTION: Compresses a buffer, giving up as soon as the output would
+ *                not fit
+ *   INPUTS: src - the data
+ *           len - the size of src
+ *           dst - the output buffer
+ *           cap - the size of dst
+ *   OUTPUTS: dst
+ *   RETURN VALUE: the compressed size
+ *                 -1 - it does not fit in cap bytes
+ *   SIDE EFFECTS: none
+ */
+int32_t
+lz_compress(const uint8_t * src, uint32_t len, uint8_t * dst, uint32_t cap)
+{
+    uint32_t ip = 0, anchor = 0, op = 0;
+    uint32_t seq, ref, h, mlen;
+
+    while (ip + LZ_MIN_MATCH <= len)
+    {
+        seq = *(const uint32_t *)(src + ip);
+        h = LZ_HASH(seq);
+        ref = lz_table[h];
+        lz_table[h] = ip;
+
+        /* entries left over from another buffer can point anywhere */
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+            *(const uint32_t *)(src + ref) != seq)
+        {
+            ip++;
+            continue;
+        }
+
+        mlen = LZ_MIN_MATCH;
+        while (ip + mlen < len && src[ref + mlen] == src[ip + mlen])
+            mlen++;
+
+        if (0 != lz_emit(dst, &op, cap, src + anchor, ip - anchor,
+                         ip - ref, mlen))
+            return -1;
+
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if (0 != lz_emit(dst, &op, cap, src + anchor, len - anchor, 0, 0))
+        return -1;
+
+    return op;
+}
+
+
+/*
+ * lz_decompress
+ *   DESCRIPTION: Decompresses what lz_compress wrote, checking every length
+ *                and offset against the buffers
+ *   INPUTS: src - the compressed data
+ *           len - the size of src
+ *           dst - the output buffer
+ *           cap - the size of dst
+ *   OUTPUTS: dst
+ *   RETURN VALUE: the decompressed size
+ *                 -1 - the data is corrupt or does not fit in cap bytes
+ *   SIDE EFFECTS: none
+ */
+int32_t
+lz_decompress(const uint8_t * src, uint32_t len, uint8_t * dst, uint32_t cap)
+{
+    uint32_t ip = 0, op = 0;
+    uint32_t token, nlit, offset, mlen;
+
+    while (ip < len)
+    {
+        token = src[ip++];
+
+        nlit = token >> 4;
+        if (nlit == LZ_NIBBLE_MAX && 0 != lz_get_length(src, &ip, len, &nlit))
+            return -1;
+        if (ip + nlit > len || op + nlit > cap)
+            return -1;
+        memcpy(dst + op, src + ip, nlit);
+        ip += nlit;
+        op += nlit;
+
+        /* the last sequence has no match */
+        if (ip == len)
+            break;
+
+        if (ip + 2 > len)
+            return -1;
+        offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+
+        mlen = token & LZ_NIBBLE_MAX;
+        if (mlen == LZ_NIBBLE_MAX && 0 != lz_get_length(src, &ip, len, &mlen))
+            return -1;
+        mlen += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || op + mlen > cap)
+            return -1;
+
+        /* byte by byte, a match can overlap what it is copying */
+        while (mlen-- > 0)
+        {
+            dst[op] = dst[op - offset];
+            op++;
+        }
+    }
+
+    return op;
+}
@@ -4,16 +4,230 @@
 
 #include "paging.h"
 #include "lib.h"
+#include "frames.h"
+#include "swap.h"
+#include "futex.h"
 #include "drivers/terminal.h"
 
-#define MASK_10_BITS       0x3FF
+/* Index of an address in the directory and in its page table. With PAE the
+   one directory in use covers the first 1GB, which holds every mapping. */
+#define DIR_INDEX(addr)    ((addr) >> SHIFT_LARGE)
+#define TABLE_INDEX(addr)  (((addr) >> SHIFT_4KB) & (TABLE_ENTRIES - 1))
 
+/* The frame an entry points to; frames are all below 4GB */
+#define ENTRY_FRAME(entry) ((uint32_t)(entry) & ~(_4KB - 1))
 
-/* Arrays to hold the Page Directory and the table for the first 4MB section */
-static uint32_t page_directory[PAGE_COUNT] __attribute__((aligned(PAGE_ALIGN)));
-static uint32_t first_4MB_table[PAGE_COUNT] __attribute__((aligned(PAGE_ALIGN)));
-static uint32_t user_4MB_table[PAGE_COUNT] __attribute__((aligned(PAGE_ALIGN)));
-static uint32_t backup_vidmem_table[PAGE_COUNT] __attribute__((aligned(PAGE_ALIGN)));
+/* Flag bits of a large page entry, up to and including its PAT bit */
+#define LARGE_PAGE_FLAGS   0x1FFF
+
+/* The swap slot of a swapped out page */
+#define SWAP_SLOT(entry)   ((uint32_t)(entry) >> SHIFT_4KB)
+
+#define USER_SPACE_PAGES   ((USER_HEAP_END - USER_MEM_START) / _4KB)
+
+/* invalidations queued in a batch, more than this flushes the whole TLB */
+#define TLB_BATCH_SIZE     8
+
+
+/* Arrays to hold the kernel's Page Directory and the table for the first 4MB
+   section. The kernel directory is used until the first process runs, and
+   its entries are the kernel half of every process' directory. */
+static page_entry_t page_directory[TABLE_ENTRIES]
+                                __attribute__((aligned(PAGE_ALIGN)));
+static page_entry_t first_4MB_table[TABLE_ENTRIES]
+                                __attribute__((aligned(PAGE_ALIGN)));
+
+/* A page directory for each PID, and the 4KB table for its vidmap pages.
+   Threads run in the directory of their process' leader. */
+static page_entry_t proc_directories[MAX_PROCESSES][TABLE_ENTRIES]
+                                __attribute__((aligned(PAGE_ALIGN)));
+static page_entry_t proc_user_tables[MAX_PROCESSES][TABLE_ENTRIES]
+                                __attribute__((aligned(PAGE_ALIGN)));
+
+#ifdef PAE_PAGING
+/* CR3 points at a page directory pointer table, whose first entry holds the
+   directory of the first 1GB. The other 3GB are never mapped. */
+static page_entry_t kernel_pdpt[PDPT_ENTRIES] __attribute__((aligned(32)));
+static page_entry_t proc_pdpts[MAX_PROCESSES][PDPT_ENTRIES]
+                                __attribute__((aligned(32)));
+#endif
+
+/* Set in the entries of data pages once no-execute is enabled */
+static page_entry_t nx_bit = 0;
+
+/* Memory use of each PID's address space, live from init_page_directory
+   until free_user_space */
+static mem_stats_t proc_mem_stats[MAX_PROCESSES];
+static uint8_t proc_mem_live[MAX_PROCESSES];
+
+/* Where each address space's swap clock hand stopped, and the process
+   reclaim_idle_pages starts with next */
+static uint32_t proc_swap_hand[MAX_PROCESSES];
+static uint32_t reclaim_pid = 1;
+
+/* attr_index of VGA memory pages, 1 if PAT entry 4 is write-combining */
+static uint32_t vga_attr_index = 0;
+
+/* The address space in CR3, 0 for the kernel's */
+static uint32_t current_pid = 0;
+static page_entry_t * current_directory = page_directory;
+
+/* Pages whose TLB entries are invalidated when the open batch ends */
+static uint32_t tlb_batch_depth = 0;
+static uint32_t tlb_batch_count = 0;
+static uint32_t tlb_batch_addrs[TLB_BATCH_SIZE];
+
+
+/*
+ * invlpg
+ *   DESCRIPTION: Drops the TLB entry of a single page
+ *   INPUTS: vir_addr - a virtual address within the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static inline void
+invlpg(uint32_t vir_addr)
+{
+    asm volatile("invlpg (%0)" : : "r" (vir_addr) : "memory");
+}
+
+
+/*
+ * tlb_invalidate
+ *   DESCRIPTION: Invalidates the TLB entry of a page whose mapping changed,
+ *                right away or when the open batch ends
+ *   INPUTS: vir_addr - a virtual address within the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+tlb_invalidate(uint32_t vir_addr)
+{
+    uint32_t i;
+
+    if (tlb_batch_depth == 0)
+    {
+        invlpg(vir_addr);
+        return;
+    }
+
+    for (i = 0; i < tlb_batch_count && i < TLB_BATCH_SIZE; i++)
+    {
+        if (tlb_batch_addrs[i] == vir_addr)
+            return;
+    }
+
+    if (tlb_batch_count < TLB_BATCH_SIZE)
+        tlb_batch_addrs[tlb_batch_count] = vir_addr;
+    tlb_batch_count++;
+}
+
+
+/*
+ * account_pages
+ *   DESCRIPTION: Adds to the counts of pages mapped in an address space, and
+ *                raises its peak
+ *   INPUTS: pid - the process
+ *           resident - change in the user pages mapped
+ *           shared - change in those of them the process does not own
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+account_pages(uint32_t pid, int32_t resident, int32_t shared)
+{
+    mem_stats_t * stats = &proc_mem_stats[pid - 1];
+
+    stats->resident_pages += resident;
+    stats->shared_pages += shared;
+    if (stats->resident_pages > stats->peak_resident_pages)
+        stats->peak_resident_pages = stats->resident_pages;
+}
+
+
+/*
+ * make_entry
+ *   DESCRIPTION: Widens a directory or table entry built with one of the
+ *                bitfield types into an entry of the paging structures
+ *   INPUTS: entry - the pde_4M_t, pde_4K_t or pte_t
+ *   OUTPUTS: none
+ *   RETURN VALUE: the entry
+ *   SIDE EFFECTS: none
+ */
+static inline page_entry_t
+make_entry(const void * entry)
+{
+    uint32_t bytes;
+    memcpy(&bytes, entry, sizeof(uint32_t));
+    return bytes;
+}
+
+
+/*
+ * user_frame
+ *   DESCRIPTION: Allocates a frame for user memory, swapping out pages of
+ *                idle processes to make room if there is none
+ *   INPUTS: zeroed - 1 if the frame has to be cleared, 0 if not
+ *   OUTPUTS: none
+ *   RETURN VALUE: the physical address of the frame, 0 if none could be
+ *                 freed
+ *   SIDE EFFECTS: may swap out pages
+ */
+static uint32_t
+user_frame(int32_t zeroed)
+{
+    uint32_t frame;
+
+    frame = zeroed ? alloc_zeroed_frame() : alloc_frame();
+    if (frame == 0 && reclaim_idle_pages(SWAP_RECLAIM_BATCH) > 0)
+        frame = zeroed ? alloc_zeroed_frame() : alloc_frame();
+
+    return frame;
+}
+
+
+/*
+ * map_kernel_range
+ *   DESCRIPTION: Identity maps a range of the kernel directory with large
+ *                pages
+ *   INPUTS: start - the first address, large page aligned
+ *           end - the end of the range, large page aligned
+ *           flags - the flag bits of every entry
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+map_kernel_range(uint32_t start, uint32_t end, page_entry_t flags)
+{
+    uint32_t addr;
+
+    for (addr = start; addr < end; addr += LARGE_PAGE_SIZE)
+        page_directory[DIR_INDEX(addr)] = flags | addr;
+}
+
+
+/*
+ * directory_base
+ *   DESCRIPTION: Returns the value of CR3 for an address space
+ *   INPUTS: pid - the process, 0 for the kernel's address space
+ *   OUTPUTS: none
+ *   RETURN VALUE: the address of its directory, or of its page directory
+ *                 pointer table with PAE
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+directory_base(uint32_t pid)
+{
+#ifdef PAE_PAGING
+    return (uint32_t)(pid ? proc_pdpts[pid - 1] : kernel_pdpt);
+#else
+    return (uint32_t)(pid ? proc_directories[pid - 1] : page_directory);
+#endif
+}
 
 
 /*
@@ -30,6 +244,15 @@ init_paging(void)
 {
     int i;
 
+    /* screen writes stream through write-combining if there is a PAT */
+    vga_attr_index = enable_pat_wc();
+
+#ifdef PAE_PAGING
+    /* bit 63 is reserved, and faults, until EFER.NXE is set */
+    if (enable_nx())
+        nx_bit = PAGE_NX;
+#endif
+
     /* Initialize all PDE's to be NOT present, Read/Write, Supervisor */
     pde_4M_t default_pde;
     memset(&(default_pde), 0, sizeof(pde_4M_t));
@@ -37,43 +260,23 @@ init_paging(void)
     default_pde.read_write = 1;
     default_pde.user_supervisor = 0;
 
-    for (i = 0; i < PAGE_COUNT; i++)
-        memcpy(&page_directory[i], &default_pde, sizeof(pde_4M_t));
+    for (i = 0; i < TABLE_ENTRIES; i++)
+        page_directory[i] = make_entry(&default_pde);
 
-    /* Initialize the 4KB PTE's for the first 4MB table in physical memory,
-       to NOT present, Read/Write, Supervisor */
+    /* Initialize the 4KB PTE's for the first 4MB table in physical memory
+       (2MB with PAE), to NOT present, Read/Write, Supervisor */
     pte_t init_pte;
     memset(&(init_pte), 0, sizeof(pte_t));
     init_pte.present = 0;
     init_pte.read_write = 1;
     init_pte.user_supervisor = 0;
 
-    for (i = 0; i < PAGE_COUNT; i++)
+    for (i = 0; i < TABLE_ENTRIES; i++)
     {
         init_pte.base_addr = i;
-        memcpy(&first_4MB_table[i], &init_pte, sizeof(pte_t));
+        first_4MB_table[i] = make_entry(&init_pte);
     }
 
-    /* Initialize the 4KB PTE's for the user 4KB page table */
-    pte_t user_pte;
-    memset(&(user_pte), 0, sizeof(pte_t));
-    user_pte.present = 0;
-    user_pte.read_write = 1;
-    user_pte.user_supervisor = 1;
-
-    for (i = 0; i < PAGE_COUNT; i++)
-        memcpy(&user_4MB_table[i], &user_pte, sizeof(pte_t));
-
-    /* Initialize the 4KB PTE's for the vidmem backup 4KB page table */
-    pte_t vidmem_pte;
-    memset(&(vidmem_pte), 0, sizeof(pte_t));
-    vidmem_pte.present = 0;
-    vidmem_pte.read_write = 1;
-    vidmem_pte.user_supervisor = 0;
-
-    for (i = 0; i < PAGE_COUNT; i++)
-        memcpy(&backup_vidmem_table[i], &vidmem_pte, sizeof(pte_t));
-
     /* Initialize video memory pages (32KB) starting at 0xB8000,
        to present, Read/Write, Supervisor */
     pte_t video_mem_pte;
@@ -81,12 +284,14 @@ init_paging(void)
     video_mem_pte.present = 1;
     video_mem_pte.read_write = 1;
     video_mem_pte.user_supervisor = 0;
+    video_mem_pte.global = 1;
+    video_mem_pte.attr_index = vga_attr_index;
 
     for (i = 0; i < VIDEO_MEM_PG_COUNT; i++)
     {
         video_mem_pte.base_addr = VIDEO_MEM_INDEX + i;
-        memcpy(&first_4MB_table[VIDEO_MEM_INDEX + i],
-               &video_mem_pte, sizeof(pte_t));
+        first_4MB_table[VIDEO_MEM_INDEX + i] =
+            make_entry(&video_mem_pte) | nx_bit;
     }
 
     /* First PDE should point to first_4MB_table, set to present, Read/Write,
@@ -97,22 +302,34 @@ init_paging(void)
     first_pde.read_write = 1;
     first_pde.user_supervisor = 1;
     first_pde.base_addr = ((uint32_t) first_4MB_table) >> SHIFT_4KB;
-    memcpy(&page_directory[0], &first_pde, sizeof(pde_4K_t));
+    page_directory[0] = make_entry(&first_pde);
 
-    /* 4MB for Kernel Space, set to present, Read/Write, Supervisor */
+    /* 4MB for Kernel Space, set to present, Read/Write, Supervisor, and
+       global since every process shares it */
     pde_4M_t kernel_pde;
     memset(&(kernel_pde), 0, sizeof(pde_4M_t));
     kernel_pde.present = 1;
     kernel_pde.read_write = 1;
     kernel_pde.user_supervisor = 0;
     kernel_pde.page_size = 1;
-    kernel_pde.base_addr = KERNEL_MEM_START >> SHIFT_4MB;
-    memcpy(&page_directory[1], &kernel_pde, sizeof(pde_4M_t));
+    kernel_pde.global = 1;
+    map_kernel_range(KERNEL_MEM_START, KERNEL_MEM_START + _4MB,
+                     make_entry(&kernel_pde));
+
+    /* The frames of user and terminal memory are supervisor data, identity
+       mapped for the kernel to fill them */
+    map_kernel_range(FRAMES_START, FRAMES_END,
+                     make_entry(&kernel_pde) | nx_bit);
+
+#ifdef PAE_PAGING
+    kernel_pdpt[0] = (uint32_t) page_directory | PAGE_PRESENT;
+#endif
 
     /* give the page_directory pointer to CR3 */
-    load_page_directory((uint32_t) page_directory);
+    load_page_directory(directory_base(0));
     /* call the enabler */
     enable_paging();
+    enable_global_pages();
 }
 
 
@@ -124,15 +341,23 @@ init_paging(void)
  *           pde - the entry to put into the Page Directory for this page
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Flushes the x86 TLBs
+ *   SIDE EFFECTS: Invalidates the page's TLB entry
  */
 void
 map_page_4MB(uint32_t vir_addr, pde_4M_t pde)
 {
-    uint32_t pde_bytes;
-    memcpy(&pde_bytes, &pde, sizeof(pde_4M_t));
-    page_directory[(vir_addr >> SHIFT_4MB)] = pde_bytes;
-    flush_tlb();
+    page_entry_t entry = make_entry(&pde);
+    uint32_t phys_addr = (uint32_t)entry & ~(_4MB - 1);
+    uint32_t offset;
+
+    /* two 2MB pages with PAE */
+    vir_addr &= ~(_4MB - 1);
+    for (offset = 0; offset < _4MB; offset += LARGE_PAGE_SIZE)
+    {
+        current_directory[DIR_INDEX(vir_addr + offset)] =
+            (entry & LARGE_PAGE_FLAGS) | (phys_addr + offset);
+        tlb_invalidate(vir_addr + offset);
+    }
 }
 
 
@@ -142,7 +367,7 @@ map_page_4MB(uint32_t vir_addr, pde_4M_t pde)
  *   INPUTS: phys_addr - the physical address to use in the page mapping
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Flushes the x86 TLBs
+ *   SIDE EFFECTS: Invalidates the page's TLB entry
  */
 void
 map_actual_vidmem(uint32_t phys_addr)
@@ -152,12 +377,76 @@ map_actual_vidmem(uint32_t phys_addr)
     video_mem_pte.present = 1;
     video_mem_pte.read_write = 1;
     video_mem_pte.user_supervisor = 0;
-    video_mem_pte.base_addr = phys_addr >> SHIFT_4KB;
+    video_mem_pte.global = 1;
+    set_vidmem_pte(&video_mem_pte, phys_addr);
 
-    memcpy(&first_4MB_table[VIDEO_MEM_INDEX],
-           &video_mem_pte, sizeof(pte_t));
+    first_4MB_table[VIDEO_MEM_INDEX] = make_entry(&video_mem_pte) | nx_bit;
 
-    flush_tlb();
+    /* a global entry survives the full flush a batch may end with */
+    invlpg(VIDEO_MEM_START);
+}
+
+
+/*
+ * set_vidmem_pte
+ *   DESCRIPTION: Points a page entry at a screen. Screens in VGA memory are
+ *                write-combining; screens in RAM keep the default type, as
+ *                the kernel's own mapping of that RAM does.
+ *   INPUTS: pte - the entry to change
+ *           phys_addr - the physical address of the screen
+ *   OUTPUTS: pte
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+set_vidmem_pte(pte_t * pte, uint32_t phys_addr)
+{
+    pte->base_addr = phys_addr >> SHIFT_4KB;
+
+    if (phys_addr >= VIDEO_MEM_START &&
+        phys_addr < VIDEO_MEM_START + VIDEO_MEM_PG_COUNT * _4KB)
+        pte->attr_index = vga_attr_index;
+    else
+        pte->attr_index = 0;
+}
+
+
+/*
+ * map_proc_page
+ *   DESCRIPTION: Maps a 4KB page of the vidmap region in the address space of
+ *                any process, running or not
+ *   INPUTS: pid - the process whose directory to change
+ *           vir_addr - the virtual address within the page to map
+ *           pte - the entry to put into the Page Table for this page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Invalidates the page's TLB entry if pid is running
+ */
+void
+map_proc_page(uint32_t pid, uint32_t vir_addr, pte_t pte)
+{
+    page_entry_t * table = proc_user_tables[pid - 1];
+    page_entry_t * entry = &table[TABLE_INDEX(vir_addr)];
+
+    /* the terminal owns these pages, the process only shares them */
+    if (!(*entry & PAGE_PRESENT) && pte.present)
+        account_pages(pid, 1, 1);
+    else if ((*entry & PAGE_PRESENT) && !pte.present)
+        account_pages(pid, -1, -1);
+
+    *entry = make_entry(&pte) | nx_bit;
+
+    pde_4K_t pde;
+    memset(&(pde), 0, sizeof(pde_4K_t));
+    pde.present = 1;
+    pde.read_write = 1;
+    pde.user_supervisor = 1;
+    pde.base_addr = ((uint32_t) table) >> SHIFT_4KB;
+    proc_directories[pid - 1][DIR_INDEX(vir_addr)] = make_entry(&pde);
+
+    /* other address spaces have no TLB entries, CR3 loads dropped them */
+    if (pid == current_pid)
+        tlb_invalidate(vir_addr);
 }
 
 
@@ -169,90 +458,603 @@ map_actual_vidmem(uint32_t phys_addr)
  *           pte - the entry to put into the Page Table for this page
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Flushes the x86 TLBs
+ *   SIDE EFFECTS: Invalidates the page's TLB entry
  */
 void
 map_user_video_mem(uint32_t vir_addr, pte_t pte)
 {
-    uint32_t pte_bytes;
-    memcpy(&pte_bytes, &pte, sizeof(pte_t));
-    user_4MB_table[(vir_addr >> SHIFT_4KB) & MASK_10_BITS] = pte_bytes;
+    map_proc_page(current_pid, vir_addr, pte);
+}
+
+
+/*
+ * user_table
+ *   DESCRIPTION: Finds the page table covering a user address in the current
+ *                directory, and can create it from a fresh frame
+ *   INPUTS: vir_addr - the user address
+ *           create - 1 to create a missing table, 0 not to
+ *   OUTPUTS: none
+ *   RETURN VALUE: the page table, NULL if missing or out of frames
+ *   SIDE EFFECTS: none
+ */
+static page_entry_t *
+user_table(uint32_t vir_addr, int32_t create)
+{
+    page_entry_t * dir_entry = &current_directory[DIR_INDEX(vir_addr)];
+    uint32_t frame;
+
+    if (*dir_entry & PAGE_PRESENT)
+        return (page_entry_t *)ENTRY_FRAME(*dir_entry);
+    if (!create || 0 == (frame = user_frame(1)))
+        return NULL;
 
     pde_4K_t pde;
     memset(&(pde), 0, sizeof(pde_4K_t));
     pde.present = 1;
     pde.read_write = 1;
     pde.user_supervisor = 1;
-    pde.base_addr = ((uint32_t) user_4MB_table) >> SHIFT_4KB;
-    memcpy(&page_directory[(vir_addr >> SHIFT_4MB)], &pde, sizeof(pde_4K_t));
+    pde.available = PAGE_AVAIL_OWNED;
+    pde.base_addr = frame >> SHIFT_4KB;
+    *dir_entry = make_entry(&pde);
+    proc_mem_stats[current_pid - 1].table_pages++;
 
-    flush_tlb();
+    return (page_entry_t *)frame;
 }
 
 
 /*
- * free_user_video_mem
- *   DESCRIPTION: Unmaps the page for the 4KB video memory.
- *   INPUTS: none
+ * map_user_page
+ *   DESCRIPTION: Backs one unmapped user page with a fresh zeroed frame owned
+ *                by the current process. Called with interrupts off.
+ *   INPUTS: vir_addr - an address within the page
  *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: Flushes the x86 TLBs
+ *   RETURN VALUE: 0 - success, or the page was already mapped
+ *                 -1 - out of frames
+ *   SIDE EFFECTS: none
  */
-void
-free_user_video_mem(uint32_t vir_addr)
+static int32_t
+map_user_page(uint32_t vir_addr)
 {
+    uint32_t frame;
+    page_entry_t * table;
+    page_entry_t * entry;
+
+    if (NULL == (table = user_table(vir_addr, 1)))
+        return -1;
+
+    entry = &table[TABLE_INDEX(vir_addr)];
+    if (*entry & (PAGE_PRESENT | PAGE_SWAPPED))
+        return 0;
+
+    if (0 == (frame = user_frame(1)))
+        return -1;
+
     pte_t pte;
     memset(&(pte), 0, sizeof(pte_t));
-    pte.present = 0;
+    pte.present = 1;
     pte.read_write = 1;
-    pte.user_supervisor = 0;
+    pte.user_supervisor = 1;
+    pte.available = PAGE_AVAIL_OWNED;
+    pte.base_addr = frame >> SHIFT_4KB;
+    *entry = make_entry(&pte);
+    if (vir_addr >= USER_HEAP_START)
+        *entry |= nx_bit;
+    account_pages(current_pid, 1, 0);
+
+    return 0;
+}
+
+
+/*
+ * map_user_pages
+ *   DESCRIPTION: Backs the unmapped pages of a user range with fresh zeroed
+ *                frames owned by the current process. Swapped out pages
+ *                count as mapped and are left alone. Heap pages are not
+ *                executable; the image is, and so are the stacks, where
+ *                signal delivery puts the sigreturn code. Interrupts are
+ *                only held off for one page at a time.
+ *   INPUTS: start - the first address of the range, page aligned
+ *           end - the end of the range, page aligned
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - success
+ *                 -1 - out of frames, the pages mapped so far stay mapped
+ *   SIDE EFFECTS: none, the pages were not present so nothing is in the TLB
+ */
+int32_t
+map_user_pages(uint32_t start, uint32_t end)
+{
+    uint32_t flags, vir_addr;
+    int32_t ret;
 
-    uint32_t pte_bytes;
-    memcpy(&pte_bytes, &pte, sizeof(pte_t));
-    user_4MB_table[(vir_addr >> SHIFT_4KB) & MASK_10_BITS] = pte_bytes;
+    for (vir_addr = start; vir_addr < end; vir_addr += _4KB)
+    {
+        cli_and_save(flags);
+        ret = map_user_page(vir_addr);
+        restore_flags(flags);
+
+        if (ret != 0)
+            return -1;
+    }
 
-    flush_tlb();
+    return 0;
 }
 
 
 /*
- * map_backup_vidmem
- *   DESCRIPTION: Maps the given virtual address of the backup terminal video
- *                memory to the given physical address
- *   INPUTS: vir_addr, phys_addr - the addresses
+ * unmap_user_pages
+ *   DESCRIPTION: Unmaps a user range of the current process and frees the
+ *                frames it owned there, and its pages in the swap store
+ *   INPUTS: start - the first address of the range, page aligned
+ *           end - the end of the range, page aligned
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Flushes the x86 TLBs
+ *   SIDE EFFECTS: Invalidates the pages' TLB entries
  */
 void
-map_backup_vidmem(uint32_t vir_addr, uint32_t phys_addr)
+unmap_user_pages(uint32_t start, uint32_t end)
 {
-    pte_t pte;
-    memset(&(pte), 0, sizeof(pte_t));
-    pte.present = 1;
-    pte.read_write = 1;
-    pte.user_supervisor = 0;
-    pte.base_addr = phys_addr >> SHIFT_4KB;
+    uint32_t flags, vir_addr;
+    page_entry_t * table;
+    page_entry_t * entry;
 
-    uint32_t pte_bytes;
-    memcpy(&pte_bytes, &pte, sizeof(pte_t));
-    backup_vidmem_table[(vir_addr >> SHIFT_4KB) & MASK_10_BITS] = pte_bytes;
+    cli_and_save(flags);
+    tlb_batch_begin();
 
-    pde_4K_t pde;
-    memset(&(pde), 0, sizeof(pde_4K_t));
-    pde.present = 1;
-    pde.read_write = 1;
-    pde.user_supervisor = 0;
-    pde.base_addr = ((uint32_t) backup_vidmem_table) >> SHIFT_4KB;
-    memcpy(&page_directory[(vir_addr >> SHIFT_4MB)], &pde, sizeof(pde_4K_t));
+    for (vir_addr = start; vir_addr < end; vir_addr += _4KB)
+    {
+        if (NULL == (table = user_table(vir_addr, 0)))
+            continue;
+
+        entry = &table[TABLE_INDEX(vir_addr)];
+        if (*entry & PAGE_SWAPPED)
+        {
+            swap_free(SWAP_SLOT(*entry));
+            proc_mem_stats[current_pid - 1].swapped_pages--;
+            *entry = 0;
+            continue;
+        }
+        if (!(*entry & PAGE_PRESENT))
+            continue;
+
+        if (*entry & PAGE_OWNED)
+        {
+            free_frame(ENTRY_FRAME(*entry));
+            account_pages(current_pid, -1, 0);
+        }
+        else
+            account_pages(current_pid, -1, -1);
+        *entry = 0;
+        tlb_invalidate(vir_addr);
+    }
+
+    tlb_batch_end();
+    restore_flags(flags);
+}
+
+
+/*
+ * user_range_mapped
+ *   DESCRIPTION: Checks that every page of a range is mapped with user
+ *                access in the current address space. Swapped out pages
+ *                count, touching them brings them back in.
+ *   INPUTS: addr - start of the range
+ *           len - length of the range in bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it is all mapped, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+user_range_mapped(uint32_t addr, uint32_t len)
+{
+    uint32_t vir_addr;
+    page_entry_t * table;
+    page_entry_t entry;
+
+    if (len == 0)
+        return 1;
+
+    for (vir_addr = addr & ~(_4KB - 1); vir_addr < addr + len;
+         vir_addr += _4KB)
+    {
+        if (NULL == (table = user_table(vir_addr, 0)))
+            return 0;
+
+        entry = table[TABLE_INDEX(vir_addr)];
+        if (!(entry & PAGE_USER) || !(entry & (PAGE_PRESENT | PAGE_SWAPPED)))
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * init_page_directory
+ *   DESCRIPTION: Gives a new process an empty address space: a directory
+ *                holding only the kernel's entries, and no vidmap pages
+ *   INPUTS: pid - the new process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may flush the x86 TLBs
+ */
+void
+init_page_directory(uint32_t pid)
+{
+    /* the kernel directory has no user entries to copy */
+    memcpy(proc_directories[pid - 1], page_directory, PAGE_ALIGN);
+    memset(proc_user_tables[pid - 1], 0, PAGE_ALIGN);
+    memset(&proc_mem_stats[pid - 1], 0, sizeof(mem_stats_t));
+    proc_mem_live[pid - 1] = 1;
+    proc_swap_hand[pid - 1] = USER_MEM_START;
+
+#ifdef PAE_PAGING
+    memset(proc_pdpts[pid - 1], 0, sizeof(proc_pdpts[pid - 1]));
+    proc_pdpts[pid - 1][0] = (uint32_t) proc_directories[pid - 1] |
+                             PAGE_PRESENT;
+#endif
+
+    /* a reused PID may still be in CR3, as when a terminal's shell restarts */
+    if (pid == current_pid)
+        flush_tlb();
+}
+
+
+/*
+ * free_user_space
+ *   DESCRIPTION: Frees all the frames a process owns, its pages in the swap
+ *                store, and the page tables holding them, when it ends
+ *   INPUTS: pid - the process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none, the process' TLB entries go with the next CR3 load
+ */
+void
+free_user_space(uint32_t pid)
+{
+    page_entry_t * directory = proc_directories[pid - 1];
+    page_entry_t * table;
+    uint32_t i, j;
+
+    proc_mem_live[pid - 1] = 0;
+
+    for (i = DIR_INDEX(USER_MEM_START); i < DIR_INDEX(USER_HEAP_END); i++)
+    {
+        /* the vidmap table is not owned, its pages belong to terminals */
+        if (!(directory[i] & PAGE_OWNED))
+            continue;
+
+        table = (page_entry_t *)ENTRY_FRAME(directory[i]);
+        for (j = 0; j < TABLE_ENTRIES; j++)
+        {
+            if (table[j] & PAGE_SWAPPED)
+                swap_free(SWAP_SLOT(table[j]));
+            else if ((table[j] & PAGE_PRESENT) && (table[j] & PAGE_OWNED))
+                free_frame(ENTRY_FRAME(table[j]));
+        }
+
+        free_frame((uint32_t)table);
+        directory[i] = 0;
+    }
+}
+
+
+/*
+ * switch_page_directory
+ *   DESCRIPTION: Switches to the address space of a process with a single
+ *                CR3 load. The kernel's pages are global and stay in the TLB.
+ *   INPUTS: pid - the process, or the leader of the thread, to switch to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Flushes the non-global TLB entries
+ */
+void
+switch_page_directory(uint32_t pid)
+{
+    if (pid == current_pid)
+        return;
+
+    current_pid = pid;
+    current_directory = proc_directories[pid - 1];
+    load_page_directory(directory_base(pid));
+}
+
+
+/*
+ * virt_to_phys
+ *   DESCRIPTION: Translates a virtual address through the page directory
+ *   INPUTS: vir_addr - the virtual address to translate
+ *   OUTPUTS: none
+ *   RETURN VALUE: the physical address, 0 if the address is not mapped
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+virt_to_phys(uint32_t vir_addr)
+{
+    page_entry_t pde = current_directory[DIR_INDEX(vir_addr)];
+    page_entry_t pte;
+
+    if (!(pde & PAGE_PRESENT))
+        return 0;
+
+    /* 4MB page, 2MB with PAE */
+    if (pde & PAGE_SIZE_4MB)
+        return ((uint32_t)pde & ~(LARGE_PAGE_SIZE - 1)) |
+               (vir_addr & (LARGE_PAGE_SIZE - 1));
+
+    /* 4KB page - page tables are in kernel memory, which is identity mapped */
+    pte = ((page_entry_t *)ENTRY_FRAME(pde))[TABLE_INDEX(vir_addr)];
+    if (!(pte & PAGE_PRESENT))
+        return 0;
+
+    return ENTRY_FRAME(pte) | (vir_addr & (_4KB - 1));
+}
+
+
+/*
+ * count_page_fault
+ *   DESCRIPTION: Counts a page fault that was served in the running
+ *                address space
+ *   INPUTS: major - 1 if the page had to be read back in, 0 if a fresh page
+ *                   was mapped
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+count_page_fault(int32_t major)
+{
+    if (current_pid == 0)
+        return;
+
+    if (major)
+        proc_mem_stats[current_pid - 1].major_faults++;
+    else
+        proc_mem_stats[current_pid - 1].minor_faults++;
+}
+
+
+/*
+ * swap_out_pages
+ *   DESCRIPTION: Runs the swap clock over an address space that is not in
+ *                CR3, so none of its pages are in the TLB. A page touched
+ *                since the hand last passed gets its accessed bit cleared,
+ *                one that was not is compressed into the swap store and
+ *                its frame freed.
+ *   INPUTS: pid - the process
+ *           max - the most pages to swap out
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of pages swapped out
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+swap_out_pages(uint32_t pid, uint32_t max)
+{
+    page_entry_t * directory = proc_directories[pid - 1];
+    page_entry_t * table;
+    page_entry_t * entry;
+    uint32_t vir_addr, next, scanned, frame, evicted = 0;
+    int32_t slot;
+
+    vir_addr = proc_swap_hand[pid - 1];
+
+    /* two turns, the first may only clear accessed bits */
+    for (scanned = 0; scanned < 2 * USER_SPACE_PAGES && evicted < max; )
+    {
+        if (vir_addr >= USER_HEAP_END)
+            vir_addr = USER_MEM_START;
+
+        /* skip missing tables, and the vidmap table the process does not
+           own */
+        if (!(directory[DIR_INDEX(vir_addr)] & PAGE_OWNED))
+        {
+            next = (vir_addr & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+            scanned += (next - vir_addr) / _4KB;
+            vir_addr = next;
+            continue;
+        }
+
+        table = (page_entry_t *)ENTRY_FRAME(directory[DIR_INDEX(vir_addr)]);
+        entry = &table[TABLE_INDEX(vir_addr)];
+        frame = ENTRY_FRAME(*entry);
+
+        if ((*entry & (PAGE_PRESENT | PAGE_OWNED)) ==
+            (PAGE_PRESENT | PAGE_OWNED))
+        {
+            if (*entry & PAGE_ACCESSED)
+                *entry &= ~PAGE_ACCESSED;
+            else if (!futex_frame_in_use(frame) &&
+                     (slot = swap_out(frame)) >= 0)
+            {
+                free_frame(frame);
+                *entry = (*entry & (nx_bit | (_4KB - 1)) &
+                          ~(PAGE_PRESENT | PAGE_DIRTY)) |
+                         PAGE_SWAPPED | ((page_entry_t)slot << SHIFT_4KB);
+                account_pages(pid, -1, 0);
+                proc_mem_stats[pid - 1].swapped_pages++;
+                evicted++;
+            }
+        }
+
+        vir_addr += _4KB;
+        scanned++;
+    }
+
+    proc_swap_hand[pid - 1] = vir_addr;
+    return evicted;
+}
+
+
+/*
+ * swap_in_page
+ *   DESCRIPTION: Brings a swapped out page of the running address space back
+ *                into a fresh frame
+ *   INPUTS: vir_addr - the address that faulted
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - the page is back
+ *                 -1 - the page is not swapped out, or out of frames
+ *   SIDE EFFECTS: may swap out pages of idle processes for the frame
+ */
+int32_t
+swap_in_page(uint32_t vir_addr)
+{
+    page_entry_t * table;
+    page_entry_t * entry;
+    uint32_t flags, frame;
+
+    if (current_pid == 0 || vir_addr < USER_MEM_START ||
+        vir_addr >= USER_HEAP_END)
+        return -1;
+
+    cli_and_save(flags);
+
+    /* reclaiming for the frame leaves the running address space alone, so
+       the entry stays where it is */
+    if (NULL == (table = user_table(vir_addr, 0)) ||
+        !(*(entry = &table[TABLE_INDEX(vir_addr)]) & PAGE_SWAPPED) ||
+        0 == (frame = user_frame(0)))
+    {
+        restore_flags(flags);
+        return -1;
+    }
+
+    if (0 != swap_in(SWAP_SLOT(*entry), frame))
+    {
+        free_frame(frame);
+        restore_flags(flags);
+        return -1;
+    }
+
+    *entry = (*entry & (nx_bit | (_4KB - 1)) & ~PAGE_SWAPPED) |
+             PAGE_PRESENT | frame;
+    account_pages(current_pid, 1, 0);
+    proc_mem_stats[current_pid - 1].swapped_pages--;
+
+    restore_flags(flags);
+    return 0;
+}
+
+
+/*
+ * reclaim_idle_pages
+ *   DESCRIPTION: Swaps out cold pages of idle processes, taking the
+ *                processes in turn across calls. The address space in CR3 is
+ *                never touched.
+ *   INPUTS: count - the most pages to swap out
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of pages swapped out
+ *   SIDE EFFECTS: frees frames
+ */
+uint32_t
+reclaim_idle_pages(uint32_t count)
+{
+    uint32_t flags, i, pid, evicted = 0;
+
+    cli_and_save(flags);
+
+    for (i = 0; i < MAX_PROCESSES && evicted < count; i++)
+    {
+        pid = reclaim_pid;
+        reclaim_pid = reclaim_pid % MAX_PROCESSES + 1;
+
+        if (!proc_mem_live[pid - 1] || pid == current_pid ||
+            !process_idle(get_pcb_by_pid(pid)))
+            continue;
+
+        evicted += swap_out_pages(pid, count - evicted);
+    }
+
+    restore_flags(flags);
+    return evicted;
+}
+
+
+/*
+ * mem_stats
+ *   DESCRIPTION: Copies the memory use of a process to user space
+ *   INPUTS: pid - the process, 0 for the caller's own
+ *           stats - where to put it
+ *   OUTPUTS: stats
+ *   RETURN VALUE: 0 - success
+ *                 -1 - pid is not a running process (or is a thread), or
+ *                      stats is not in user memory
+ *   SIDE EFFECTS: none
+ */
+int32_t
+mem_stats(int32_t pid, mem_stats_t * stats)
+{
+    uint32_t flags;
+
+    /* threads run in the address space of their leader */
+    if (pid == 0)
+        pid = current_pid;
+
+    if (pid < 1 || pid > MAX_PROCESSES ||
+        bad_userspace_addr(stats, sizeof(mem_stats_t)))
+        return -1;
+
+    cli_and_save(flags);
+    if (!proc_mem_live[pid - 1])
+    {
+        restore_flags(flags);
+        return -1;
+    }
+    memcpy(stats, &proc_mem_stats[pid - 1], sizeof(mem_stats_t));
+    restore_flags(flags);
+
+    return 0;
+}
+
+
+/*
+ * tlb_batch_begin
+ *   DESCRIPTION: Starts a batch of mapping changes. Their TLB entries are
+ *                invalidated together when the batch ends. Batches nest, and
+ *                must run with interrupts off.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+tlb_batch_begin(void)
+{
+    tlb_batch_depth++;
+}
+
+
+/*
+ * tlb_batch_end
+ *   DESCRIPTION: Ends a batch of mapping changes. Each changed page is
+ *                invalidated on its own, unless there were too many and the
+ *                whole TLB is flushed instead.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Invalidates the changed pages' TLB entries
+ */
+void
+tlb_batch_end(void)
+{
+    uint32_t i;
+
+    if (--tlb_batch_depth > 0)
+        return;
+
+    if (tlb_batch_count > TLB_BATCH_SIZE)
+        flush_tlb();
+    else
+    {
+        for (i = 0; i < tlb_batch_count; i++)
+            invlpg(tlb_batch_addrs[i]);
+    }
 
-    flush_tlb();
+    tlb_batch_count = 0;
 }
 
 
 /*
  * flush_tlb
- *   DESCRIPTION: Flushes the x86 TLBs
+ *   DESCRIPTION: Flushes the x86 TLBs, except the entries of global pages
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
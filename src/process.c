@@ -2,14 +2,18 @@
 
 #include "process.h"
 #include "paging.h"
+#include "frames.h"
+#include "swap.h"
 #include "drivers/terminal.h"
 #include "x86/i8259.h"
 #include "x86/x86_desc.h"
 #include "syscalls/syscalls.h"
+#include "signal.h"
 
 static uint8_t available_pids[MAX_PROCESSES] = {0};
 
 static volatile uint32_t exec_term = 0;
+static volatile uint32_t pit_ticks = 0;
 
 /*
  * get_pcb
@@ -29,6 +33,38 @@ get_pcb()
 }
 
 
+/*
+ * get_process
+ *   DESCRIPTION: Get the PCB of the process that the current thread belongs
+ *                to. This is the thread group leader, which owns the file
+ *                descriptors, the args and the memory mappings.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: Pointer to the leader's pcb as a pcb_t
+ *   SIDE EFFECTS: none
+ */
+pcb_t*
+get_process()
+{
+    return get_pcb()->leader;
+}
+
+
+/*
+ * get_pcb_by_pid
+ *   DESCRIPTION: Get the address of the PCB for the given PID in kmemory
+ *   INPUTS: pid - the Process ID (1 to MAX_PROCESSES)
+ *   OUTPUTS: none
+ *   RETURN VALUE: Pointer to the pcb as a pcb_t
+ *   SIDE EFFECTS: none
+ */
+pcb_t*
+get_pcb_by_pid(uint32_t pid)
+{
+    return (pcb_t *)(_8MB - pid * _8KB);
+}
+
+
 /*
  * get_available_pid
  *   DESCRIPTION: Finds and sets an unused Process ID
@@ -36,7 +72,8 @@ get_pcb()
  *   OUTPUTS: none
  *   RETURN VALUE: The available PID number
  *                 -1 if unavailable
- *   SIDE EFFECTS: Sets that PID number to used
+ *   SIDE EFFECTS: Sets that PID number to used. Reclaims the PID of an
+ *                 exited thread if no other PID is free
  */
 int32_t
 get_available_pid()
@@ -51,6 +88,17 @@ get_available_pid()
         }
     }
 
+    /* reuse the kernel stack of an exited thread, unless we are still on it */
+    for (i = 0; i < MAX_PROCESSES; i++)
+    {
+        if (get_pcb_by_pid(i + 1)->state == TASK_DEAD &&
+            get_pcb_by_pid(i + 1) != get_pcb())
+        {
+            get_pcb_by_pid(i + 1)->state = TASK_RUNNABLE;
+            return i + 1;
+        }
+    }
+
     return -1;
 }
 
@@ -78,6 +126,138 @@ free_pid(uint32_t pid)
 }
 
 
+/*
+ * grow_user_stack
+ *   DESCRIPTION: Maps the pages between an address and the top of the
+ *                calling thread's stack, if the address lies in the thread's
+ *                stack slot and not too far below its stack pointer
+ *   INPUTS: addr - the user address that was touched
+ *           user_esp - the thread's user stack pointer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - the stack now reaches addr
+ *                 -1 - addr is not a stack access, or out of frames
+ *   SIDE EFFECTS: may map new pages
+ */
+int32_t
+grow_user_stack(uint32_t addr, uint32_t user_esp)
+{
+    uint32_t stack_top;
+
+    stack_top = USER_STACK_TOP - get_pcb()->stack_slot * THREAD_STACK_SIZE;
+
+    if (addr >= stack_top || addr < stack_top - THREAD_STACK_SIZE ||
+        addr + STACK_GROW_SLACK < user_esp)
+        return -1;
+
+    return map_user_pages(addr & ~(_4KB - 1), stack_top);
+}
+
+
+/*
+ * process_idle
+ *   DESCRIPTION: Checks if a process is idle: it is waiting for a child to
+ *                halt, or all of its threads are blocked
+ *   INPUTS: leader - the process' leader
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it is idle, 0 if it may run
+ *   SIDE EFFECTS: none
+ */
+int32_t
+process_idle(pcb_t * leader)
+{
+    terminal_t * term = get_term(leader->term_num);
+    pcb_t * thread = leader;
+    uint32_t i;
+
+    /* only the newest process of a terminal runs */
+    for (i = 0; i + 1 < term->num_procs; i++)
+    {
+        if (term->child_procs[i] == leader)
+            return 1;
+    }
+    if (term->num_procs == 0 ||
+        term->child_procs[term->num_procs - 1] != leader)
+        return 0;
+
+    do
+    {
+        if (thread->state != TASK_BLOCKED)
+            return 0;
+        thread = thread->next_thread;
+    } while (thread != leader);
+
+    return 1;
+}
+
+
+/*
+ * thread_exit
+ *   DESCRIPTION: Ends the calling thread. It is unlinked from its process and
+ *                its PID is reclaimed once another thread is running.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: Switches to another thread
+ */
+void
+thread_exit(void)
+{
+    pcb_t * thread = get_pcb();
+    pcb_t * prev = thread->leader;
+
+    cli();
+
+    /* unlink the thread from the process' thread ring */
+    while (prev->next_thread != thread)
+        prev = prev->next_thread;
+    prev->next_thread = thread->next_thread;
+    if (thread->leader->curr_thread == thread)
+        thread->leader->curr_thread = prev;
+    thread->leader->used_stack_slots &= ~(1 << thread->stack_slot);
+
+    thread->state = TASK_DEAD;
+
+    /* wait here until the scheduler picks another thread */
+    while (1)
+    {
+        schedule();
+        sti();
+        asm volatile("hlt");
+        cli();
+    }
+}
+
+
+/*
+ * kill_threads
+ *   DESCRIPTION: Ends every thread of the given process except its first one
+ *   INPUTS: leader - the process' pcb
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Frees the PIDs of the threads. Frames that any thread of
+ *                 the process was zeroing for the pool are given back, as
+ *                 none of them resumes.
+ */
+void
+kill_threads(pcb_t * leader)
+{
+    pcb_t * thread;
+
+    zero_pool_cancel(&leader->zeroing_frame);
+    for (thread = leader->next_thread; thread != leader;
+         thread = thread->next_thread)
+    {
+        zero_pool_cancel(&thread->zeroing_frame);
+        thread->state = TASK_DEAD;
+        free_pid(thread->pid);
+    }
+
+    leader->next_thread = leader;
+    leader->curr_thread = leader;
+    leader->used_stack_slots = 1;
+}
+
+
 /*
  * pit_init
  *   DESCRIPTION: Initializes the PIT to send interrupts every 25 milliseconds
@@ -102,41 +282,234 @@ pit_init(void)
 
 /*
  * pit_interrupt_handler
- *   DESCRIPTION: Handles the PIT interrupt - attempts to do a context switch
- *                to another process if there is one.
+ *   DESCRIPTION: Handles the PIT interrupt - counts the tick, raises expired
+ *                alarms and timeouts, and attempts to do a context switch to
+ *                another thread if there is one.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: The executing process changes
+ *   SIDE EFFECTS: The executing thread changes
  */
 void
 pit_interrupt_handler(void)
 {
+    uint32_t pid;
+    pcb_t * pcb;
+
     send_eoi(PIT_IRQ);
 
     cli();
 
-    /* calculate the next terminal's process to execute */
-    uint32_t next_term = exec_term + 1;
-    if (next_term >= MAX_TERMINALS)
-        next_term = 0;
-    while (next_term != exec_term)
+    pit_ticks++;
+
+    /* raise SIG_ALARM for processes whose alarm has expired, and wake up
+       threads whose sleep has timed out */
+    for (pid = 1; pid <= MAX_PROCESSES; pid++)
     {
-        if (get_term(next_term)->num_procs > 0)
+        pcb = get_pcb_by_pid(pid);
+        if (!available_pids[pid - 1])
+            continue;
+
+        if (pcb->leader == pcb && pcb->alarm_tick != 0 &&
+            pcb->alarm_tick == pit_ticks)
         {
-            context_switch(next_term);
-            break;
+            pcb->alarm_tick = 0;
+            send_signal(pcb, SIG_ALARM);
         }
 
-        next_term++;
-        if (next_term >= MAX_TERMINALS)
-            next_term = 0;
+        if (pcb->wake_tick != 0 && pcb->wake_tick == pit_ticks)
+        {
+            pcb->wake_tick = 0;
+            wake_thread(pcb);
+        }
     }
 
+    schedule();
     sti();
 }
 
 
+/*
+ * pick_thread
+ *   DESCRIPTION: Finds the next thread to run on the given terminal. Only the
+ *                newest process of a terminal runs, and its threads are
+ *                taken in turn, starting after the one that ran last.
+ *   INPUTS: term_num - the terminal to look at
+ *   OUTPUTS: none
+ *   RETURN VALUE: the thread's pcb, or NULL if none can run
+ *   SIDE EFFECTS: none
+ */
+static pcb_t *
+pick_thread(uint32_t term_num)
+{
+    terminal_t * term = get_term(term_num);
+    pcb_t * last;
+    pcb_t * thread;
+
+    if (term->num_procs == 0)
+        return NULL;
+
+    last = term->child_procs[term->num_procs - 1]->curr_thread;
+    thread = last;
+    do
+    {
+        thread = thread->next_thread;
+        if (thread->state == TASK_RUNNABLE || thread->state == TASK_NEW)
+            return thread;
+    } while (thread != last);
+
+    return NULL;
+}
+
+
+/*
+ * schedule
+ *   DESCRIPTION: Round-robin scheduler. Gives the processor to the next thread
+ *                that can run, checking the other terminals first and then
+ *                the other threads of the executing process.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: May switch to another thread. Must be called with
+ *                 interrupts disabled
+ */
+void
+schedule(void)
+{
+    uint32_t i, next_term, live;
+    pcb_t * next;
+
+    live = live_terminals();
+    for (i = 1; i <= MAX_TERMINALS; i++)
+    {
+        next_term = (exec_term + i) % MAX_TERMINALS;
+        if (!(live & (1 << next_term)))
+            continue;
+        next = pick_thread(next_term);
+        if (next != NULL)
+        {
+            if (next != get_pcb())
+                context_switch(next);
+            return;
+        }
+    }
+}
+
+
+/*
+ * wait_on
+ *   DESCRIPTION: Puts the calling thread to sleep on the given wait queue until
+ *                it is woken up. Callers must check their wake condition with
+ *                interrupts disabled before calling, or the wake up can be
+ *                missed.
+ *   INPUTS: wq - the wait queue to sleep on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Switches to other threads while sleeping
+ */
+void
+wait_on(wait_queue_t * wq)
+{
+    uint32_t flags;
+
+    cli_and_save(flags);
+    *wq |= PID_MASK(get_pcb()->pid);
+    sleep_thread();
+    restore_flags(flags);
+}
+
+
+/*
+ * sleep_thread
+ *   DESCRIPTION: Blocks the calling thread until wake_thread is called on it.
+ *                Other threads run in the meantime, and if none can, the
+ *                processor idles. The caller must already be on the wait
+ *                queues that will wake it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Switches to other threads while sleeping
+ */
+void
+sleep_thread(void)
+{
+    pcb_t * pcb = get_pcb();
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    pcb->state = TASK_BLOCKED;
+    while (pcb->state == TASK_BLOCKED)
+    {
+        schedule();
+
+        /* nothing else can run - zero pages for later and swap out pages
+           of idle processes while memory is low, then idle until an
+           interrupt wakes us */
+        if (pcb->state == TASK_BLOCKED &&
+            !zero_pool_refill(&pcb->zeroing_frame) &&
+            (free_frame_count() >= SWAP_LOW_WATER ||
+             0 == reclaim_idle_pages(SWAP_RECLAIM_BATCH)))
+            asm volatile("sti; hlt; cli");
+    }
+
+    restore_flags(flags);
+}
+
+
+/*
+ * wake_up
+ *   DESCRIPTION: Wakes up every thread sleeping on the given wait queue
+ *   INPUTS: wq - the wait queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Empties the wait queue
+ */
+void
+wake_up(wait_queue_t * wq)
+{
+    uint32_t pid;
+
+    for (pid = 1; pid <= MAX_PROCESSES; pid++)
+    {
+        if (*wq & PID_MASK(pid))
+            wake_thread(get_pcb_by_pid(pid));
+    }
+    *wq = 0;
+}
+
+
+/*
+ * wake_thread
+ *   DESCRIPTION: Makes a sleeping thread runnable again
+ *   INPUTS: pcb - the thread to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+wake_thread(pcb_t * pcb)
+{
+    if (pcb->state == TASK_BLOCKED)
+        pcb->state = TASK_RUNNABLE;
+}
+
+
+/*
+ * get_pit_ticks
+ *   DESCRIPTION: Returns the number of PIT interrupts since boot
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: uint32_t - the tick count (PIT_TICK_MS each)
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+get_pit_ticks()
+{
+    return pit_ticks;
+}
+
+
 /*
  * get_exec_term_num
  *   DESCRIPTION: Returns the number of the executing terminal
@@ -169,29 +542,26 @@ set_exec_term_num(uint32_t num)
 
 /*
  * context_switch
- *   DESCRIPTION: Causes the processor to start executing the active process of
- *                the given terminal
- *   INPUTS: next_term - the terminal who's process to execute
+ *   DESCRIPTION: Causes the processor to start executing the given thread
+ *   INPUTS: new_pcb - the thread to execute
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: Stack pointers are now changed
  */
 void
-context_switch(uint32_t next_term)
+context_switch(pcb_t * new_pcb)
 {
     pcb_t * old_pcb;
-    pcb_t * new_pcb;
-    uint32_t num_procs;
 
-    /* get the PCB's */
-    num_procs = get_term(next_term)->num_procs;
     old_pcb = get_pcb();
-    new_pcb = get_term(next_term)->child_procs[num_procs - 1];
 
-    /* change userspace 128MB page's mapping to next proccess */
-    map_page_4MB(new_pcb->pde_virt_addr, new_pcb->pde);
+    /* switch to the next process' address space, unless the thread shares
+       the address space of the current one */
+    if (new_pcb->leader != old_pcb->leader)
+        switch_page_directory(new_pcb->leader->pid);
 
-    exec_term = next_term;
+    exec_term = new_pcb->term_num;
+    new_pcb->leader->curr_thread = new_pcb;
 
     /* update TSS ESP0 */
     tss.esp0 = new_pcb->esp0;
@@ -203,6 +573,19 @@ context_switch(uint32_t next_term)
         : "=r" (old_pcb->k_esp), "=r" (old_pcb->k_ebp)
     );
 
+    /* a new thread has no kernel context yet, go straight to user mode */
+    if (new_pcb->state == TASK_NEW)
+    {
+        new_pcb->state = TASK_RUNNABLE;
+        asm volatile (
+            "movl %0, %%esp        \n\t"
+            "jmp thread_start"
+            :
+            : "r" (new_pcb->k_esp)
+            : "%esp"
+        );
+    }
+
     /* overwrite the esp & ebp value for next process */
     asm volatile (
         "movl %0, %%esp        \n\t"
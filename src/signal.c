@@ -0,0 +1,235 @@
+/*
+ * signal.c - Signal delivery. Signals are queued on a process and delivered
+ * to whichever of its threads next returns to user mode, by pushing a
+ * handler frame onto that thread's user stack.
+ */
+
+#include "signal.h"
+#include "lib.h"
+#include "process.h"
+#include "x86/x86_desc.h"
+#include "syscalls/syscalls.h"
+
+/* movl $SYS_SIGRETURN, %eax; int $0x80 */
+static const uint8_t sigreturn_code[SIG_TRAMPOLINE_SIZE] = {
+    0xB8, SYS_SIGRETURN, 0x00, 0x00, 0x00, 0xCD, 0x80, 0x90
+};
+
+
+/*
+ * send_signal
+ *   DESCRIPTION: Marks a signal as pending for a process. Sleeping threads of
+ *                the process are woken up so that it gets delivered.
+ *   INPUTS: process - the pcb of the process (its leader)
+ *           signum - the signal number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+send_signal(pcb_t * process, uint32_t signum)
+{
+    pcb_t * thread;
+    uint32_t flags;
+
+    if (signum >= NUM_SIGNALS)
+        return;
+
+    cli_and_save(flags);
+
+    process->sig_pending |= SIG_MASK(signum);
+
+    thread = process;
+    do
+    {
+        wake_thread(thread);
+        thread = thread->next_thread;
+    } while (thread != process);
+
+    restore_flags(flags);
+}
+
+
+/*
+ * signal_pending
+ *   DESCRIPTION: Checks if the current process has a signal to handle, so that
+ *                a sleeping system call can give up early
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a signal is pending, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t
+signal_pending(void)
+{
+    pcb_t * process = get_process();
+    return (process->sig_pending & ~process->sig_masked) != 0;
+}
+
+
+/*
+ * do_signal
+ *   DESCRIPTION: Delivers a pending signal to the current thread before it
+ *                returns to user mode. Runs the default action if no handler
+ *                is set, otherwise pushes a frame onto the user stack that
+ *                calls the handler and then sigreturn.
+ *   INPUTS: context - the registers the thread will return to user mode with
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies the user context, or halts the process
+ */
+void
+do_signal(hw_context_t * context)
+{
+    uint32_t flags, signum, pending, user_esp, trampoline;
+    pcb_t * process;
+
+    /* only when going back to user mode */
+    if ((context->cs & USER_PRIVILEGE) != USER_PRIVILEGE)
+        return;
+
+    cli_and_save(flags);
+
+    process = get_process();
+    pending = process->sig_pending & ~process->sig_masked;
+    if (pending == 0)
+    {
+        restore_flags(flags);
+        return;
+    }
+
+    /* lower signal numbers go first */
+    for (signum = 0; !(pending & SIG_MASK(signum)); signum++);
+    process->sig_pending &= ~SIG_MASK(signum);
+
+    if (process->sig_handlers[signum] == NULL)
+    {
+        /* default action - kill or ignore */
+        if (SIG_KILL_MASK & SIG_MASK(signum))
+        {
+            get_pcb()->retval = RETURN_EXCEPTION;
+            halt(0);
+        }
+        restore_flags(flags);
+        return;
+    }
+
+    /* push the sigreturn code, the context, signum and the return address */
+    user_esp = context->esp - SIG_TRAMPOLINE_SIZE;
+    trampoline = user_esp;
+    user_esp -= sizeof(hw_context_t) + 2 * _4B;
+
+    if (bad_userspace_addr((void *)user_esp, context->esp - user_esp))
+    {
+        /* the handler frame does not fit, the stack is broken */
+        get_pcb()->retval = RETURN_EXCEPTION;
+        halt(0);
+    }
+
+    memcpy((void *)trampoline, sigreturn_code, SIG_TRAMPOLINE_SIZE);
+    memcpy((void *)(user_esp + 2 * _4B), context, sizeof(hw_context_t));
+    ((uint32_t *)user_esp)[1] = signum;
+    ((uint32_t *)user_esp)[0] = trampoline;
+
+    /* run the handler with all signals masked until it returns */
+    process->sig_masked = SIG_ALL_MASK;
+    context->esp = user_esp;
+    context->eip = (uint32_t)process->sig_handlers[signum];
+
+    restore_flags(flags);
+}
+
+
+/*
+ * set_handler
+ *   DESCRIPTION: Sets the user function to run when a signal is delivered
+ *   INPUTS: signum - the signal number
+ *           handler - the user function, NULL for the default action
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - successful
+ *                 -1 - invalid signal number or handler
+ *   SIDE EFFECTS: none
+ */
+int32_t
+set_handler(int32_t signum, void * handler)
+{
+    if (signum < 0 || signum >= NUM_SIGNALS)
+        return -1;
+
+    if (handler != NULL && bad_userspace_addr(handler, 1))
+        return -1;
+
+    get_process()->sig_handlers[signum] = handler;
+    return 0;
+}
+
+
+/*
+ * sigreturn
+ *   DESCRIPTION: Returns from a signal handler. Restores the context that was
+ *                saved on the user stack by do_signal.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the EAX value of the restored context
+ *   SIDE EFFECTS: Overwrites the context this system call returns with
+ */
+int32_t
+sigreturn(void)
+{
+    hw_context_t * context = USER_CONTEXT(get_pcb());
+    /* the handler returned into the trampoline, popping the return address */
+    hw_context_t * saved = (hw_context_t *)(context->esp + _4B);
+
+    if (bad_userspace_addr(saved, sizeof(hw_context_t)))
+        return -1;
+
+    memcpy(context, saved, sizeof(hw_context_t));
+
+    /* never let the user change privilege level or disable interrupts */
+    context->cs = USER_CS;
+    context->ss = USER_DS;
+    context->ds = USER_DS;
+    context->es = USER_DS;
+    context->fs = USER_DS;
+    context->eflags = (context->eflags & EFLAGS_USER_MASK) | USER_EFLAGS;
+
+    get_process()->sig_masked = 0;
+
+    return context->eax;
+}
+
+
+/*
+ * alarm
+ *   DESCRIPTION: Schedules a SIG_ALARM for the current process. A handler can
+ *                call alarm again to get periodic signals.
+ *   INPUTS: ms - milliseconds from now, 0 to cancel the alarm
+ *   OUTPUTS: none
+ *   RETURN VALUE: milliseconds left of the previous alarm, 0 if none
+ *   SIDE EFFECTS: none
+ */
+int32_t
+alarm(uint32_t ms)
+{
+    pcb_t * process = get_process();
+    uint32_t flags, now, left;
+
+    cli_and_save(flags);
+
+    now = get_pit_ticks();
+    left = 0;
+    if (process->alarm_tick != 0)
+        left = (process->alarm_tick - now) * PIT_TICK_MS;
+
+    process->alarm_tick = 0;
+    if (ms != 0)
+    {
+        /* round up to whole ticks - 0 means that no alarm is set */
+        process->alarm_tick = now + (ms + PIT_TICK_MS - 1) / PIT_TICK_MS;
+        if (process->alarm_tick == 0)
+            process->alarm_tick = 1;
+    }
+
+    restore_flags(flags);
+    return left;
+}
@@ -0,0 +1,286 @@
+/*
+ * swap.c - Compressed in-RAM store for the pages of idle processes. A page
+ * is compressed with the LZ codec and packed with others into store frames,
+ * a few 256 byte chunks each, so several swapped out pages share one frame.
+ * Pages of zeroes take no room at all. Each stored page has a slot, whose
+ * number its page table entry keeps while it is not present.
+ */
+
+#include "swap.h"
+#include "frames.h"
+#include "lz.h"
+
+typedef struct swap_slot {
+    uint16_t store;
+    uint8_t chunk;
+    /* 0 for a page of zeroes */
+    uint8_t nchunks;
+    uint16_t length;
+} swap_slot_t;
+
+/* Store frames, and a bitmap of the chunks used in each */
+static uint32_t store_frames[SWAP_STORE_FRAMES];
+static uint16_t store_used[SWAP_STORE_FRAMES];
+static uint32_t num_store_frames = 0;
+
+/* Slots of stored pages, the free ones on a stack */
+static swap_slot_t slots[SWAP_SLOTS];
+static uint32_t free_slots[SWAP_SLOTS];
+static uint32_t num_free_slots = 0;
+
+/* Pages are compressed here first, to see how many chunks they need */
+static uint8_t swap_buf[SWAP_MAX_CHUNKS * SWAP_CHUNK_SIZE];
+
+
+/*
+ * swap_init
+ *   DESCRIPTION: Puts every slot on the free stack
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+swap_init(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < SWAP_SLOTS; i++)
+        free_slots[i] = SWAP_SLOTS - 1 - i;
+    num_free_slots = SWAP_SLOTS;
+}
+
+
+/*
+ * store_alloc
+ *   DESCRIPTION: Finds a run of free chunks in the store frames, taking a
+ *                new frame if none of them has room
+ *   INPUTS: nchunks - the number of chunks needed
+ *           slot - the slot to record the chunks in
+ *   OUTPUTS: slot
+ *   RETURN VALUE: 0 - success
+ *                 -1 - there is no room and no free frame
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+store_alloc(uint32_t nchunks, swap_slot_t * slot)
+{
+    uint32_t mask = (1 << nchunks) - 1;
+    uint32_t i, chunk, frame;
+
+    for (i = 0; i < SWAP_STORE_FRAMES; i++)
+    {
+        if (store_frames[i] == 0)
+            continue;
+
+        for (chunk = 0; chunk + nchunks <= SWAP_CHUNKS; chunk++)
+        {
+            if (!(store_used[i] & (mask << chunk)))
+            {
+                store_used[i] |= mask << chunk;
+                slot->store = i;
+                slot->chunk = chunk;
+                return 0;
+            }
+        }
+    }
+
+    for (i = 0; i < SWAP_STORE_FRAMES; i++)
+    {
+        if (store_frames[i] != 0)
+            continue;
+
+        if (0 == (frame = alloc_frame()))
+            return -1;
+
+        store_frames[i] = frame;
+        store_used[i] = mask;
+        num_store_frames++;
+        slot->store = i;
+        slot->chunk = 0;
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/*
+ * is_zero_page
+ *   DESCRIPTION: Checks if a frame holds nothing but zeroes
+ *   INPUTS: frame - the physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it does, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+is_zero_page(uint32_t frame)
+{
+    uint32_t * word = (uint32_t *)frame;
+    uint32_t i;
+
+    for (i = 0; i < _4KB / sizeof(uint32_t); i++)
+    {
+        if (word[i] != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * swap_out
+ *   DESCRIPTION: Compresses a page into the store. The frame is left as it
+ *                was; the caller frees it.
+ *   INPUTS: frame - the physical address of the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot holding the page
+ *                 -1 - it does not compress well enough, or there is no
+ *                      room for it
+ *   SIDE EFFECTS: may take a frame for the store
+ */
+int32_t
+swap_out(uint32_t frame)
+{
+    uint32_t flags, nchunks, num;
+    int32_t length;
+    swap_slot_t slot;
+
+    cli_and_save(flags);
+
+    if (num_free_slots == 0)
+    {
+        restore_flags(flags);
+        return -1;
+    }
+
+    memset(&slot, 0, sizeof(swap_slot_t));
+
+    if (!is_zero_page(frame))
+    {
+        length = lz_compress((uint8_t *)frame, _4KB, swap_buf,
+                             sizeof(swap_buf));
+        if (length < 0)
+        {
+            restore_flags(flags);
+            return -1;
+        }
+
+        nchunks = (length + SWAP_CHUNK_SIZE - 1) / SWAP_CHUNK_SIZE;
+        if (0 != store_alloc(nchunks, &slot))
+        {
+            restore_flags(flags);
+            return -1;
+        }
+
+        slot.nchunks = nchunks;
+        slot.length = length;
+        memcpy((uint8_t *)store_frames[slot.store] +
+               slot.chunk * SWAP_CHUNK_SIZE, swap_buf, length);
+    }
+
+    num = free_slots[--num_free_slots];
+    slots[num] = slot;
+
+    restore_flags(flags);
+    return num;
+}
+
+
+/*
+ * swap_in
+ *   DESCRIPTION: Decompresses a stored page into a frame and frees its slot
+ *   INPUTS: slot - the slot holding the page
+ *           frame - the physical address to put it at
+ *   OUTPUTS: the frame
+ *   RETURN VALUE: 0 - success
+ *                 -1 - the stored page is corrupt, the slot is kept
+ *   SIDE EFFECTS: may give a store frame back
+ */
+int32_t
+swap_in(uint32_t slot, uint32_t frame)
+{
+    swap_slot_t * s = &slots[slot];
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    if (s->nchunks == 0)
+        memset((void *)frame, 0, _4KB);
+    else if (_4KB != lz_decompress((uint8_t *)store_frames[s->store] +
+                                   s->chunk * SWAP_CHUNK_SIZE, s->length,
+                                   (uint8_t *)frame, _4KB))
+    {
+        restore_flags(flags);
+        return -1;
+    }
+
+    swap_free(slot);
+
+    restore_flags(flags);
+    return 0;
+}
+
+
+/*
+ * swap_free
+ *   DESCRIPTION: Drops a stored page, as when its process ends
+ *   INPUTS: slot - the slot holding the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: gives the store frame back once it is empty
+ */
+void
+swap_free(uint32_t slot)
+{
+    swap_slot_t * s = &slots[slot];
+    uint32_t flags;
+
+    cli_and_save(flags);
+
+    if (s->nchunks != 0)
+    {
+        store_used[s->store] &= ~(((1 << s->nchunks) - 1) << s->chunk);
+        if (store_used[s->store] == 0)
+        {
+            free_frame(store_frames[s->store]);
+            store_frames[s->store] = 0;
+            num_store_frames--;
+        }
+    }
+
+    free_slots[num_free_slots++] = slot;
+
+    restore_flags(flags);
+}
+
+
+/*
+ * swapped_page_count
+ *   DESCRIPTION: Returns the number of pages in the store
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of stored pages
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+swapped_page_count(void)
+{
+    return SWAP_SLOTS - num_free_slots;
+}
+
+
+/*
+ * swap_frame_count
+ *   DESCRIPTION: Returns the number of frames holding the store
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of store frames
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+swap_frame_count(void)
+{
+    return num_store_frames;
+}
@@ -11,18 +11,25 @@
 #include "drivers/rtc.h"
 #include "drivers/keyboard.h"
 #include "drivers/terminal.h"
-
-static file_ops_t fs_ops = {fs_open, fs_close, fs_read, fs_write};
-static file_ops_t rtc_ops = {rtc_open, rtc_close, rtc_read, rtc_write};
+#include "drivers/serial.h"
+#include "signal.h"
+
+static file_ops_t fs_ops = {fs_open, fs_close, fs_read, fs_write, fs_poll};
+static file_ops_t rtc_ops = {rtc_open, rtc_close, rtc_read, rtc_write,
+                             rtc_poll};
+static file_ops_t serial_ops = {serial_open, serial_close, serial_read,
+                                serial_write, serial_poll};
 static file_ops_t stdin_ops = {terminal_open, terminal_close,
-                               terminal_read, NULL};
+                               terminal_read, NULL, terminal_poll};
 static file_ops_t stdout_ops = {terminal_open, terminal_close,
-                                NULL, terminal_write};
+                                NULL, terminal_write, terminal_poll};
 
 
 /*
  * halt
- *   DESCRIPTION: Halts the given process and returns back to parent process
+ *   DESCRIPTION: Halts the given process and returns back to parent process.
+ *                When called by a thread other than the process' first one,
+ *                only that thread exits.
  *   INPUTS: status - The status returned from the user process
  *   OUTPUTS: none
  *   RETURN VALUE: never returns (jumps back to execute)
@@ -44,6 +51,14 @@ halt(uint8_t status)
     else
         retval = status;
 
+    /* a thread only ends itself, unless it faulted (never returns) */
+    if (pcb != pcb->leader && retval != RETURN_EXCEPTION)
+        thread_exit();
+
+    /* end the whole process - stop all its other threads first */
+    pcb = pcb->leader;
+    kill_threads(pcb);
+
     /* close file descriptors */
     for (i = 0; i < MAX_OPEN_FILES; i++)
     {
@@ -51,17 +66,16 @@ halt(uint8_t status)
             pcb->fds[i].file_ops->close(i);
     }
 
+    /* give back the frames of its memory */
+    free_user_space(pcb->pid);
+
     /* free the PID (should never fail) */
+    pcb->state = TASK_DEAD;
     if (0 != free_pid(pcb->pid))
         printf("Should not have printed!\n");
 
-    /* unmap video memory if previously mapped */
-    if (pcb->vidmem_virt_addr != 0)
-        free_user_video_mem(pcb->vidmem_virt_addr);
-
     /* update this process' terminal */
-    executing_term()->num_procs--;
-    executing_term()->child_procs[executing_term()->num_procs] = NULL;
+    terminal_remove_proc(executing_term());
 
     if (pcb->parent == NULL) // First process on current terminal
     {
@@ -78,8 +92,8 @@ halt(uint8_t status)
         k_ebp = pcb->parent->k_ebp;
         esp0 = pcb->parent->esp0;
 
-        /* restore paging by mapping parent's page in the page directory */
-        map_page_4MB(pcb->parent->pde_virt_addr, pcb->parent->pde);
+        /* restore paging by going back to the parent's address space */
+        switch_page_directory(pcb->parent->leader->pid);
     }
 
     /* restore parent data */
@@ -125,7 +139,7 @@ execute(const uint8_t * command)
     );
 
     void* load_addr;
-    uint32_t retval, copied, bytes_read;
+    uint32_t retval, copied, bytes_read, image_end, file_end;
 
     // get the first word in command -> filename
     uint8_t filename[FILENAME_SIZE];
@@ -136,7 +150,7 @@ execute(const uint8_t * command)
     uint16_t i, args_length = 0;
 
     /* check if command pointer is within userspace */
-    if((uint32_t) command < _128MB || (uint32_t) command >= (_128MB + _4MB))
+    if (bad_userspace_addr(command, 1))
     {
         /* check if command pointer is within kernel space */
         if((uint32_t) command < _4MB || (uint32_t) command >= (_4MB + _4MB))
@@ -179,6 +193,15 @@ execute(const uint8_t * command)
     /* get executable start address */
     void * eip = get_elf_entrypoint(dentry.inode);
 
+    /* the image and its zero-filled data have to fit below the stacks */
+    image_end = get_elf_image_end(dentry.inode);
+    file_end = _128MB + IMAGE_LOAD_OFFSET +
+               get_inode_ptr(dentry.inode)->length;
+    if (image_end < file_end)
+        image_end = file_end;
+    if (image_end > USER_STACKS_BOTTOM)
+        return -1;
+
     pcb_t pcb;
     memset(&pcb, 0, sizeof(pcb_t));
 
@@ -196,32 +219,23 @@ execute(const uint8_t * command)
         memcpy(pcb.args, args, args_length + 1);
     pcb.args_length = args_length;
 
-    /* create 4MB page for new process (either at 8MB or 12MB physical) */
-    pcb.pde_virt_addr = _128MB;
     pcb.vidmem_virt_addr = 0; // vidmem = NULL
-
-    /* clear the pcb's pde entry and set the bits */
-    // memset(&(pcb.pde), 0, sizeof(pde_4M_t));
-    pcb.pde.present = 1;
-    pcb.pde.read_write = 1;
-    pcb.pde.user_supervisor = 1;
-    pcb.pde.writethrough = 0;
-    pcb.pde.cache_disabled = 0;
-    pcb.pde.accessed = 0;
-    pcb.pde.dirty = 0;
-    pcb.pde.page_size = 1;
-    pcb.pde.global = 0;
-    pcb.pde.available = 0;
-    pcb.pde.attr_index = 0;
-    pcb.pde.reserved = 0;
-    pcb.pde.base_addr = (_8MB + _4MB * (pcb.pid - 1)) >> BASE_ADDR_4MB_OFFSET;
+    pcb.vidbuf_virt_addr = 0;
+    pcb.brk = USER_HEAP_START;
 
     /* initialize the user stack base and pointer */
-    pcb.ebp = pcb.esp = _128MB + _4MB - _4B;
+    pcb.ebp = pcb.esp = USER_STACK_TOP - _4B;
 
     /* initialize the kernel stack pointer */
     pcb.k_ebp = pcb.k_esp = pcb.esp0 = _8MB - _4B - (pcb.pid - 1) * _8KB;
 
+    /* the process starts out as a single thread using stack slot 0 */
+    pcb.state = TASK_RUNNABLE;
+    pcb.term_num = get_exec_term_num();
+    pcb.used_stack_slots = 1;
+    pcb.leader = pcb.next_thread = pcb.curr_thread =
+                        (pcb_t *)(pcb.k_esp & ESP_PCB_MASK);
+
     /* load the parent pcb pointer */
     if (executing_term()->num_procs == 0)
         // we are the first process in curr terminal
@@ -234,8 +248,21 @@ execute(const uint8_t * command)
         pcb.parent->k_ebp = ret_kebp;
     }
 
-    /* map this page in the page directory */
-    map_page_4MB(pcb.pde_virt_addr, pcb.pde);
+    /* give the process its own address space, with pages for the image and
+       the main stack */
+    init_page_directory(pcb.pid);
+    switch_page_directory(pcb.pid);
+    if (0 != map_user_pages((_128MB + IMAGE_LOAD_OFFSET) & ~(_4KB - 1),
+                            PAGE_ROUND_UP(image_end)) ||
+        0 != map_user_pages(USER_STACK_TOP - USER_STACK_INIT_SIZE,
+                            USER_STACK_TOP))
+    {
+        free_user_space(pcb.pid);
+        free_pid(pcb.pid);
+        if (pcb.parent != NULL)
+            switch_page_directory(get_process()->pid);
+        return -1;
+    }
 
     /* load the program into the 128MB virtual address with offset 0x48000 */
     load_addr = (void*)(_128MB + IMAGE_LOAD_OFFSET);
@@ -270,9 +297,7 @@ execute(const uint8_t * command)
     /* copy the new pcb to the new kernel stack */
     memcpy((void*)(pcb.k_esp & ESP_PCB_MASK), &pcb, sizeof(pcb_t));
     /* put the PCB pointer in the terminal_t struct */
-    executing_term()->child_procs[executing_term()->num_procs] =
-                        (void*)(pcb.k_esp & ESP_PCB_MASK);
-    executing_term()->num_procs++;
+    terminal_add_proc(executing_term(), (pcb_t *)(pcb.k_esp & ESP_PCB_MASK));
 
     /* context switch -> write TSS values */
     tss.esp0 = pcb.esp0;
@@ -332,7 +357,7 @@ read(int32_t fd, void * buf, int32_t nbytes)
     if(buf == NULL)
         return -1;
 
-    file_desc_t fd_file = get_pcb()->fds[fd];
+    file_desc_t fd_file = get_process()->fds[fd];
 
     /* read only if file is in use */
     if((fd_file.flags & FILE_USE_MASK) == FILE_IN_USE)
@@ -363,7 +388,7 @@ write(int32_t fd, const void * buf, int32_t nbytes)
     if(buf == NULL)
         return -1;
 
-    file_desc_t fd_file = get_pcb()->fds[fd];
+    file_desc_t fd_file = get_process()->fds[fd];
 
     /* write only if file is in use */
     if((fd_file.flags & FILE_USE_MASK) == FILE_IN_USE)
@@ -389,54 +414,68 @@ open(const uint8_t * filename)
     dentry_t d;
     pcb_t * pcb;
 
-    if (-1 != read_dentry_by_name(filename, &d))
+    /* the serial port is a device with no file in the filesystem */
+    if (0 == strncmp((const int8_t *)filename, SERIAL_DEVICE_NAME,
+                     sizeof(SERIAL_DEVICE_NAME)))
     {
-        pcb = get_pcb();
-        int i = 2;
-        /* find available fd */
-        while((pcb->fds[i].flags & FILE_USE_MASK) == FILE_IN_USE)
-        {
-            i++;
-            if (i >= MAX_OPEN_FILES)
-                /* no available file descriptor */
-                return -1;
-        }
+        memset(&d, 0, sizeof(dentry_t));
+        d.filetype = SERIAL_FILE_TYPE;
+    }
+    else if (-1 == read_dentry_by_name(filename, &d))
+        return -1;
 
-        file_desc_t fd;
-        fd.pos = 0;
-        fd.flags = ((d.filetype << 1) & FILE_TYPE_MASK) | FILE_IN_USE;
+    pcb = get_process();
+    int i = 2;
+    /* find available fd */
+    while((pcb->fds[i].flags & FILE_USE_MASK) == FILE_IN_USE)
+    {
+        i++;
+        if (i >= MAX_OPEN_FILES)
+            /* no available file descriptor */
+            return -1;
+    }
 
-        if (d.filetype == RTC_FILE_TYPE)
-        {
-            if (0 != rtc_open(filename))
-                return -1;
-            fd.inode = NULL;
-            fd.file_ops = &rtc_ops;
-            memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
-            return i;
-        }
-        else if (d.filetype == DIR_FILE_TYPE)
-        {
-            if (0 != fs_open(filename))
-                return -1;
-            fd.inode = NULL;
-            fd.file_ops = &fs_ops;
-            memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
+    file_desc_t fd;
+    fd.pos = 0;
+    fd.flags = ((d.filetype << 1) & FILE_TYPE_MASK) | FILE_IN_USE;
 
-            return i;
-        }
-        else if (d.filetype == NORMAL_FILE_TYPE)
-        {
-            fd.inode = get_inode_ptr(d.inode);
-            fd.file_ops = &fs_ops;
-            memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
-            return i;
-        }
-        else
+    if (d.filetype == RTC_FILE_TYPE)
+    {
+        if (0 != rtc_open(filename))
             return -1;
+        fd.inode = NULL;
+        fd.file_ops = &rtc_ops;
+        memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
+        return i;
     }
+    else if (d.filetype == DIR_FILE_TYPE)
+    {
+        if (0 != fs_open(filename))
+            return -1;
+        fd.inode = NULL;
+        fd.file_ops = &fs_ops;
+        memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
 
-    return -1;
+        return i;
+    }
+    else if (d.filetype == NORMAL_FILE_TYPE)
+    {
+        fd.inode = get_inode_ptr(d.inode);
+        fd.file_ops = &fs_ops;
+        memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
+        return i;
+    }
+    else if (d.filetype == SERIAL_FILE_TYPE)
+    {
+        if (0 != serial_open(filename))
+            return -1;
+        fd.inode = NULL;
+        fd.file_ops = &serial_ops;
+        memcpy(pcb->fds + i, &fd, sizeof(file_desc_t));
+        return i;
+    }
+    else
+        return -1;
 }
 
 
@@ -455,7 +494,7 @@ close(int32_t fd)
     if (fd < 2 || fd >= MAX_OPEN_FILES)
         return -1;
 
-    pcb_t * pcb = get_pcb();
+    pcb_t * pcb = get_process();
 
     /* close only if file in use */
     if ((pcb->fds[fd].flags & FILE_USE_MASK) == FILE_IN_USE)
@@ -485,16 +524,16 @@ close(int32_t fd)
 int32_t
 getargs(uint8_t * buf, int32_t nbytes)
 {
-    /* check if buffer is within userspace memory */
-    if((uint32_t) buf < _128MB || (uint32_t) buf >= (_128MB + _4MB))
-        return -1;
-
-    pcb_t * pcb = get_pcb();
+    pcb_t * pcb = get_process();
 
     /* check if we have been given enough space to fit the whole args string */
     if (nbytes < pcb->args_length + 1)
         return -1;
 
+    /* check if buffer is within userspace memory */
+    if (bad_userspace_addr(buf, pcb->args_length + 1))
+        return -1;
+
     memcpy(buf, pcb->args, pcb->args_length + 1);
     return 0;
 }
@@ -514,8 +553,7 @@ int32_t
 vidmap(uint8_t** screen_start)
 {
     /* check if screen start is within userspace memory */
-    if((uint32_t) screen_start < _128MB ||
-       (uint32_t) screen_start >= (_128MB + _4MB))
+    if (bad_userspace_addr(screen_start, sizeof(uint8_t*)))
         return -1;
 
     pte_t pte;
@@ -528,15 +566,16 @@ vidmap(uint8_t** screen_start)
     pte.writethrough = 0;
     pte.cache_disabled = 0;
     pte.accessed = 0;
-    pte.attr_index = 0;
     pte.dirty = 0;
     pte.global = 0;
     pte.available = 0;
-    pte.base_addr = VIDEO_MEM_INDEX;
+    /* the terminal's own screen, whether or not it is visible */
+    set_vidmem_pte(&pte, (uint32_t)executing_term()->vidmem);
 
+    terminal_reset_scroll(executing_term());
     map_user_video_mem(USER_VIDEO_MEM_ADDR, pte);
-    get_pcb()->vidmem_virt_addr = USER_VIDEO_MEM_ADDR;
-    get_pcb()->vidmem_pte = pte;
+    get_process()->vidmem_virt_addr = USER_VIDEO_MEM_ADDR;
+    get_process()->vidmem_pte = pte;
 
     *screen_start = (uint8_t*)(USER_VIDEO_MEM_ADDR);
 
@@ -545,30 +584,343 @@ vidmap(uint8_t** screen_start)
 
 
 /*
- * set_handler
- *   DESCRIPTION: Unsupported
- *   INPUTS: signum, handler
+ * vidmap_buffers
+ *   DESCRIPTION: Maps the terminal's off-screen buffers into user space and
+ *                writes their addresses to the given array. Each buffer has
+ *                the layout of the screen and starts as a copy of it. The
+ *                process draws a frame into one and shows it with flip,
+ *                which avoids the tearing of drawing on the screen itself.
+ *   INPUTS: buffers - array of NUM_VIDBUFS pointers to fill in
+ *   OUTPUTS: buffers
+ *   RETURN VALUE: 0 - successful
+ *                 -1 - the given array is not owned by the user process
+ *   SIDE EFFECTS: creates new page mappings
+ */
+int32_t
+vidmap_buffers(uint8_t** buffers)
+{
+    terminal_t * term = executing_term();
+    pcb_t * pcb = get_process();
+    pte_t pte;
+    uint32_t i;
+
+    /* check if the whole array is within userspace memory */
+    if (bad_userspace_addr(buffers, NUM_VIDBUFS * sizeof(uint8_t*)))
+        return -1;
+
+    for (i = 0; i < NUM_VIDBUFS; i++)
+    {
+        memset(&(pte), 0, sizeof(pte_t));
+        pte.present = 1;
+        pte.read_write = 1;
+        pte.user_supervisor = 1;
+        pte.base_addr = (uint32_t)TERM_VIDBUF(term, i) >> SHIFT_4KB;
+
+        memcpy(TERM_VIDBUF(term, i), TERM_SCREEN(term),
+               NUM_ROWS * TERM_ROW_SIZE);
+        map_user_video_mem(USER_VIDBUF_ADDR + i * _4KB, pte);
+
+        buffers[i] = (uint8_t*)(USER_VIDBUF_ADDR + i * _4KB);
+    }
+    pcb->vidbuf_virt_addr = USER_VIDBUF_ADDR;
+
+    return 0;
+}
+
+
+/*
+ * flip
+ *   DESCRIPTION: Shows one of the buffers mapped by vidmap_buffers on the
+ *                process' terminal, in sync with the display if it is visible
+ *   INPUTS: buf - the index of the buffer to show
  *   OUTPUTS: none
- *   RETURN VALUE: 0 - unsupported
- *   SIDE EFFECTS: none
+ *   RETURN VALUE: 0 - successful
+ *                 -1 - no buffers are mapped or buf is out of range
+ *   SIDE EFFECTS: changes the terminal's screen
  */
 int32_t
-set_handler(int32_t signum, void * handler)
+flip(int32_t buf)
 {
+    if (get_process()->vidbuf_virt_addr == 0 ||
+        buf < 0 || buf >= NUM_VIDBUFS)
+        return -1;
+
+    terminal_flip(executing_term(), buf);
     return 0;
 }
 
 
 /*
- * sigreturn
- *   DESCRIPTION: Unsupported
- *   INPUTS: none
+ * sbrk
+ *   DESCRIPTION: Grows or shrinks the process' heap. Pages are mapped with
+ *                fresh zeroed frames as the heap grows into them, and freed
+ *                when it shrinks below them. A grow claims its range first
+ *                and maps it with interrupts on.
+ *   INPUTS: increment - the number of bytes to add, negative to give back
  *   OUTPUTS: none
- *   RETURN VALUE: 0 - unsupported
+ *   RETURN VALUE: the previous end of the heap, the start of the new memory
+ *                 -1 - out of memory, or the heap would leave its region
+ *   SIDE EFFECTS: changes page mappings
+ */
+int32_t
+sbrk(int32_t increment)
+{
+    uint32_t flags, old_brk, new_brk;
+    pcb_t * pcb;
+
+    cli_and_save(flags);
+
+    pcb = get_process();
+    old_brk = pcb->brk;
+    new_brk = old_brk + increment;
+
+    if ((increment > 0 && (new_brk > USER_HEAP_END || new_brk < old_brk)) ||
+        (increment < 0 && (new_brk < USER_HEAP_START || new_brk > old_brk)))
+    {
+        restore_flags(flags);
+        return -1;
+    }
+
+    /* other threads see the new end right away */
+    pcb->brk = new_brk;
+
+    if (increment < 0)
+        unmap_user_pages(PAGE_ROUND_UP(new_brk), PAGE_ROUND_UP(old_brk));
+
+    restore_flags(flags);
+
+    if (increment > 0 &&
+        0 != map_user_pages(PAGE_ROUND_UP(old_brk), PAGE_ROUND_UP(new_brk)))
+    {
+        /* give back what was mapped before running out, and the range
+           unless another thread has moved the end since */
+        cli_and_save(flags);
+        unmap_user_pages(PAGE_ROUND_UP(old_brk), PAGE_ROUND_UP(new_brk));
+        if (pcb->brk == new_brk)
+            pcb->brk = old_brk;
+        restore_flags(flags);
+        return -1;
+    }
+
+    return old_brk;
+}
+
+
+/*
+ * thread_create
+ *   DESCRIPTION: Creates a new thread in the calling process. The thread gets
+ *                its own kernel stack and a user stack slot inside the
+ *                process' 4MB page, and shares the file descriptors. It
+ *                starts at entry with arg as its only argument, and ends by
+ *                calling halt.
+ *   INPUTS: entry - the user function to run
+ *           arg - the argument to pass to it
+ *   OUTPUTS: none
+ *   RETURN VALUE: the thread's ID (its PID number)
+ *                 -1 - bad entry point or no PID available
+ *   SIDE EFFECTS: The new thread becomes schedulable
+ */
+int32_t
+thread_create(void * entry, void * arg)
+{
+    uint32_t flags, slot, stack_top, user_esp;
+    uint32_t * frame;
+    pcb_t thread;
+    pcb_t * process;
+    pcb_t * thread_addr;
+
+    if (bad_userspace_addr(entry, 1))
+        return -1;
+
+    cli_and_save(flags);
+
+    process = get_process();
+
+    /* find a free user stack slot */
+    for (slot = 1; slot < MAX_PROCESSES; slot++)
+    {
+        if (!(process->used_stack_slots & (1 << slot)))
+            break;
+    }
+
+    memset(&thread, 0, sizeof(pcb_t));
+
+    thread.pid = get_available_pid();
+    stack_top = USER_STACK_TOP - slot * THREAD_STACK_SIZE;
+
+    /* the slot's stack pages stay mapped for the next thread to use it */
+    if (slot >= MAX_PROCESSES || thread.pid < 1 ||
+        thread.pid > MAX_PROCESSES ||
+        0 != map_user_pages(stack_top - USER_STACK_INIT_SIZE, stack_top))
+    {
+        free_pid(thread.pid);
+        restore_flags(flags);
+        return -1;
+    }
+
+    /* push arg and a NULL return address onto the thread's user stack */
+    user_esp = stack_top - _4B;
+    user_esp -= _4B;
+    *(uint32_t *)user_esp = (uint32_t)arg;
+    user_esp -= _4B;
+    *(uint32_t *)user_esp = 0;
+
+    thread.esp0 = _8MB - _4B - (thread.pid - 1) * _8KB;
+    thread.ebp = thread.esp = user_esp;
+
+    /* build the IRET context that thread_start returns through */
+    thread.k_ebp = thread.k_esp = thread.esp0 - THREAD_FRAME_WORDS * _4B;
+    frame = (uint32_t *)thread.k_esp;
+    frame[0] = (uint32_t)entry;
+    frame[1] = USER_CS;
+    frame[2] = USER_EFLAGS;
+    frame[3] = user_esp;
+    frame[4] = USER_DS;
+
+    thread.state = TASK_NEW;
+    thread.term_num = process->term_num;
+    thread.stack_slot = slot;
+    thread.leader = process;
+    thread.next_thread = process->next_thread;
+
+    /* copy the pcb to the new kernel stack and link it into the process */
+    thread_addr = (pcb_t *)(thread.esp0 & ESP_PCB_MASK);
+    memcpy(thread_addr, &thread, sizeof(pcb_t));
+    process->next_thread = thread_addr;
+    process->used_stack_slots |= (1 << slot);
+
+    restore_flags(flags);
+
+    return thread.pid;
+}
+
+
+/*
+ * poll
+ *   DESCRIPTION: Waits until one of the given file descriptors is ready, so a
+ *                program can wait on all its event sources in one call
+ *   INPUTS: fds - the file descriptors and the POLL* events to wait for.
+ *                 revents is filled in with the events that are ready
+ *           nfds - the number of entries in fds
+ *           timeout - milliseconds to wait at most, 0 to only check, and
+ *                     negative to wait forever
+ *   OUTPUTS: fds[].revents
+ *   RETURN VALUE: the number of ready file descriptors, 0 on timeout
+ *                 -1 - bad arguments, or interrupted by a signal
+ *   SIDE EFFECTS: Sleeps until a driver wakes this thread up
+ */
+int32_t
+poll(pollfd_t * fds, uint32_t nfds, int32_t timeout)
+{
+    uint32_t flags, i, ready;
+    uint32_t * wqs[MAX_OPEN_FILES];
+    file_desc_t * file;
+    pcb_t * pcb;
+
+    if (nfds > MAX_OPEN_FILES ||
+        bad_userspace_addr(fds, nfds * sizeof(pollfd_t)))
+        return -1;
+
+    cli_and_save(flags);
+
+    pcb = get_pcb();
+    if (timeout > 0)
+    {
+        /* round up to whole ticks - 0 means that the timeout has passed */
+        pcb->wake_tick = get_pit_ticks() +
+                         (timeout + PIT_TICK_MS - 1) / PIT_TICK_MS;
+        if (pcb->wake_tick == 0)
+            pcb->wake_tick = 1;
+    }
+
+    while (1)
+    {
+        ready = 0;
+        for (i = 0; i < nfds; i++)
+        {
+            wqs[i] = NULL;
+            fds[i].revents = 0;
+
+            if (fds[i].fd < 0 || fds[i].fd >= MAX_OPEN_FILES)
+            {
+                fds[i].revents = POLLNVAL;
+                ready++;
+                continue;
+            }
+
+            file = &get_process()->fds[fds[i].fd];
+            if ((file->flags & FILE_USE_MASK) != FILE_IN_USE)
+                fds[i].revents = POLLNVAL;
+            else
+                fds[i].revents = fds[i].events &
+                                 file->file_ops->poll(fds[i].fd, &wqs[i]);
+
+            if (fds[i].revents != 0)
+                ready++;
+        }
+
+        if (ready != 0 || timeout == 0 || signal_pending() ||
+            (timeout > 0 && pcb->wake_tick == 0))
+            break;
+
+        /* sleep until any of the drivers (or the timeout) wakes us up */
+        for (i = 0; i < nfds; i++)
+        {
+            if (wqs[i] != NULL)
+                *wqs[i] |= PID_MASK(pcb->pid);
+        }
+        sleep_thread();
+        for (i = 0; i < nfds; i++)
+        {
+            if (wqs[i] != NULL)
+                *wqs[i] &= ~PID_MASK(pcb->pid);
+        }
+    }
+
+    pcb->wake_tick = 0;
+    restore_flags(flags);
+
+    if (ready == 0 && signal_pending())
+        return -1;
+    return ready;
+}
+
+
+/*
+ * fcntl
+ *   DESCRIPTION: Gets or sets the flags of a file descriptor. O_NONBLOCK
+ *                makes terminal, RTC and serial reads return -EAGAIN instead
+ *                of sleeping. O_RAW on a terminal's stdin switches it to raw
+ *                mode: keys are delivered as they are typed, without echo.
+ *   INPUTS: fd - the file descriptor number
+ *           cmd - F_GETFL or F_SETFL
+ *           arg - the new flags for F_SETFL
+ *   OUTPUTS: none
+ *   RETURN VALUE: F_GETFL - the flags
+ *                 F_SETFL - 0
+ *                 -1 - bad file descriptor or command
  *   SIDE EFFECTS: none
  */
 int32_t
-sigreturn(void)
+fcntl(int32_t fd, int32_t cmd, uint32_t arg)
 {
-    return 0;
+    file_desc_t * file;
+
+    if (fd < 0 || fd >= MAX_OPEN_FILES)
+        return -1;
+
+    file = &get_process()->fds[fd];
+    if ((file->flags & FILE_USE_MASK) != FILE_IN_USE)
+        return -1;
+
+    if (cmd == F_GETFL)
+        return file->flags & FCNTL_FLAGS;
+
+    if (cmd == F_SETFL)
+    {
+        file->flags = (file->flags & ~FCNTL_FLAGS) | (arg & FCNTL_FLAGS);
+        return 0;
+    }
+
+    return -1;
 }
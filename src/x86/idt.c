@@ -6,128 +6,151 @@
 #include "syscalls/syscalls.h"
 #include "drivers/rtc.h"
 #include "drivers/keyboard.h"
+#include "drivers/serial.h"
 #include "x86/i8259.h"
 #include "interrupts.h"
 #include "process.h"
+#include "signal.h"
 
 
 /*
- * intel_exception_X
- *   DESCRIPTION: Functions declared using the macro INTEL_EXCEPTION. Handles
- *                functionality of exceptions when they are hit. A BSOD-like
- *                screen is displayed with the Exception message and the
- *                address of the instruction that caused it.
- *   INPUTS: none (MACRO defines no inputs)
- *   OUTPUTS: The screen is cleared and exception message is displayed
- *   RETURN VALUE: none
- *   SIDE EFFECTS: Enters an infinite loop to relieve control from user
+ * fault_to_handler
+ *   DESCRIPTION: Raises the signal for an exception taken in user mode, if
+ *                the process has a handler for it that can run. do_signal
+ *                delivers it on the way back to user mode.
+ *   INPUTS: cs - the code segment the exception was taken in
+ *           signum - SIG_DIV_ZERO or SIG_SEGFAULT
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 - the handler will run
+ *                 -1 - the process has to die
+ *   SIDE EFFECTS: none
  */
-
-void intel_divide_error(void)
+static int32_t
+fault_to_handler(uint32_t cs, uint32_t signum)
 {
-    printf("INTEL EXCEPT 0: Divide by 0 error\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
-
-void intel_debug(void)
-{
-    printf("INTEL EXCEPT 1: Debug exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+    pcb_t * process = get_process();
 
-void intel_nmi(void)
-{
-    printf("INTEL EXCEPT 2: NMI interrupt\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+    if ((cs & USER_PRIVILEGE) != USER_PRIVILEGE ||
+        process->sig_handlers[signum] == NULL ||
+        (process->sig_masked & SIG_MASK(signum)))
+        return -1;
 
-void intel_int3(void)
-{
-    printf("INTEL EXCEPT 3: Breakpoint exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
+    send_signal(process, signum);
+    return 0;
 }
 
-void intel_overflow(void)
-{
-    printf("INTEL EXCEPT 4: Overflow exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
 
-void intel_bounds(void)
-{
-    printf("INTEL EXCEPT 5: Bound range exceeded\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
-
-void intel_invalid_op(void)
-{
-    printf("INTEL EXCEPT 6: Invalid opcode exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
-
-void intel_device_not_available(void)
+/*
+ * fault_kill
+ *   DESCRIPTION: Kills the process for an exception it has no handler for.
+ *                From user mode the signal is raised and do_signal applies
+ *                its default action. A fault inside a signal handler, which
+ *                runs with signals masked, or in kernel mode halts at once.
+ *   INPUTS: cs - the code segment the exception was taken in
+ *           signum - SIG_DIV_ZERO or SIG_SEGFAULT
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may halt the process
+ */
+static void
+fault_kill(uint32_t cs, uint32_t signum)
 {
-    printf("INTEL EXCEPT 7: Device not available\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+    pcb_t * process = get_process();
 
-void intel_doublefault_fn(void)
-{
-    /* Pushes Error Code */
-    printf("INTEL EXCEPT 8: Double fault\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+    if ((cs & USER_PRIVILEGE) == USER_PRIVILEGE &&
+        !(process->sig_masked & SIG_MASK(signum)))
+    {
+        send_signal(process, signum);
+        return;
+    }
 
-void intel_coprocessor_seg_overrun(void)
-{
-    printf("INTEL EXCEPT 9: Coprocessor segment overrun\n");
-    get_pcb()->retval = 256;
+    get_pcb()->retval = RETURN_EXCEPTION;
     halt(0);
 }
 
-void intel_invalid_TSS(void)
-{
-    /* Pushes Error Code */
-    printf("INTEL EXCEPT 10: Invalid TSS\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
 
-void intel_seg_not_present(void)
-{
-    /* Pushes Error Code */
-    printf("INTEL EXCEPT 11: Segment not present\n");
-    get_pcb()->retval = 256;
-    halt(0);
+/*
+ * intel_exception_X
+ *   DESCRIPTION: Functions declared using the macro INTEL_EXCEPTION. Called
+ *                from their wrappers in interrupts.S. An exception taken in
+ *                user mode raises SIG_DIV_ZERO for a division by zero and
+ *                SIG_SEGFAULT for anything else, to run the process' handler.
+ *                Without one, the exception message is displayed and the
+ *                process is killed.
+ *   INPUTS: context - the registers saved on entry
+ *   OUTPUTS: The exception message, if the process is killed
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may raise a signal or halt the process
+ */
+#define INTEL_EXCEPTION(name, signum, msg)              \
+void name(hw_context_t * context)                       \
+{                                                       \
+    if (0 == fault_to_handler(context->cs, signum))     \
+        return;                                         \
+    printf(msg);                                        \
+    fault_kill(context->cs, signum);                    \
 }
 
-void intel_stack_fault(void)
-{
-    /* Pushes Error Code */
-    printf("INTEL EXCEPT 12: Stack fault\n");
-    get_pcb()->retval = 256;
-    halt(0);
+/*
+ * intel_abort_X
+ *   DESCRIPTION: Functions declared using the macro INTEL_ABORT, for the
+ *                exceptions that are not caused by the running program. The
+ *                exception message is displayed and the process is killed.
+ *   INPUTS: context - the registers saved on entry
+ *   OUTPUTS: The exception message
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: halts the process
+ */
+#define INTEL_ABORT(name, msg)                          \
+void name(hw_context_t * context)                       \
+{                                                       \
+    printf(msg);                                        \
+    get_pcb()->retval = RETURN_EXCEPTION;               \
+    halt(0);                                            \
 }
 
-void intel_gpf(void)
-{
-    printf("INTEL EXCEPT 13: General protection exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+INTEL_EXCEPTION(intel_divide_error, SIG_DIV_ZERO,
+                "INTEL EXCEPT 0: Divide by 0 error\n")
+INTEL_EXCEPTION(intel_debug, SIG_SEGFAULT,
+                "INTEL EXCEPT 1: Debug exception\n")
+INTEL_ABORT(intel_nmi, "INTEL EXCEPT 2: NMI interrupt\n")
+INTEL_EXCEPTION(intel_int3, SIG_SEGFAULT,
+                "INTEL EXCEPT 3: Breakpoint exception\n")
+INTEL_EXCEPTION(intel_overflow, SIG_SEGFAULT,
+                "INTEL EXCEPT 4: Overflow exception\n")
+INTEL_EXCEPTION(intel_bounds, SIG_SEGFAULT,
+                "INTEL EXCEPT 5: Bound range exceeded\n")
+INTEL_EXCEPTION(intel_invalid_op, SIG_SEGFAULT,
+                "INTEL EXCEPT 6: Invalid opcode exception\n")
+INTEL_EXCEPTION(intel_device_not_available, SIG_SEGFAULT,
+                "INTEL EXCEPT 7: Device not available\n")
+INTEL_ABORT(intel_doublefault_fn, "INTEL EXCEPT 8: Double fault\n")
+INTEL_EXCEPTION(intel_coprocessor_seg_overrun, SIG_SEGFAULT,
+                "INTEL EXCEPT 9: Coprocessor segment overrun\n")
+INTEL_EXCEPTION(intel_invalid_TSS, SIG_SEGFAULT,
+                "INTEL EXCEPT 10: Invalid TSS\n")
+INTEL_EXCEPTION(intel_seg_not_present, SIG_SEGFAULT,
+                "INTEL EXCEPT 11: Segment not present\n")
+INTEL_EXCEPTION(intel_stack_fault, SIG_SEGFAULT,
+                "INTEL EXCEPT 12: Stack fault\n")
+INTEL_EXCEPTION(intel_gpf, SIG_SEGFAULT,
+                "INTEL EXCEPT 13: General protection exception\n")
 
-void intel_page_fault(void)
+/*
+ * intel_page_fault
+ *   DESCRIPTION: Brings a swapped out page back in, or grows the faulting
+ *                thread's user stack if the fault is just below it, and
+ *                raises SIG_SEGFAULT for any other fault. Called from
+ *                page_fault_exception.
+ *   INPUTS: frame - the error code and the IRET context
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may map pages, counted as major faults when swapped in
+ *                 and minor faults for the stack
+ */
+void intel_page_fault(page_fault_frame_t * frame)
 {
-    uint32_t cr2;
+    uint32_t cr2, user_esp;
     asm volatile (
         "movl  %%cr2, %%eax \n\t"
         "movl  %%eax, %0"
@@ -135,41 +158,44 @@ void intel_page_fault(void)
         :
         : "%eax"
     );
-    printf("INTEL EXCEPT 14: Page Fault\n");
-    printf("Address that was accessed (CR2): 0x%x\n", cr2);
-    get_pcb()->retval = 256;
-    halt(0);
-}
 
-/* 15 is Intel reserved */
+    /* a system call touching a user buffer faults in kernel mode */
+    if (frame->error & PF_USER)
+        user_esp = frame->esp;
+    else
+        user_esp = USER_CONTEXT(get_pcb())->esp;
 
-void intel_fpu_coprocessor_error(void)
-{
-    printf("INTEL EXCEPT 16: FPU Floating Point Error\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+    if (!(frame->error & PF_PRESENT))
+    {
+        if (0 == swap_in_page(cr2))
+        {
+            count_page_fault(1);
+            return;
+        }
+        if (0 == grow_user_stack(cr2, user_esp))
+        {
+            count_page_fault(0);
+            return;
+        }
+    }
 
-void intel_alignment_check(void)
-{
-    printf("INTEL EXCEPT 17: Alignment check exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+    if (0 == fault_to_handler(frame->cs, SIG_SEGFAULT))
+        return;
 
-void intel_machine_check(void)
-{
-    printf("INTEL EXCEPT 18: Machine check exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
+    printf("INTEL EXCEPT 14: Page Fault\n");
+    printf("Address that was accessed (CR2): 0x%x\n", cr2);
+    fault_kill(frame->cs, SIG_SEGFAULT);
 }
 
-void intel_simd_coprocessor_error(void)
-{
-    printf("INTEL EXCEPT 19: SIMD Floating Point Exception\n");
-    get_pcb()->retval = 256;
-    halt(0);
-}
+/* 15 is Intel reserved */
+
+INTEL_EXCEPTION(intel_fpu_coprocessor_error, SIG_SEGFAULT,
+                "INTEL EXCEPT 16: FPU Floating Point Error\n")
+INTEL_EXCEPTION(intel_alignment_check, SIG_SEGFAULT,
+                "INTEL EXCEPT 17: Alignment check exception\n")
+INTEL_ABORT(intel_machine_check, "INTEL EXCEPT 18: Machine check exception\n")
+INTEL_EXCEPTION(intel_simd_coprocessor_error, SIG_SEGFAULT,
+                "INTEL EXCEPT 19: SIMD Floating Point Exception\n")
 
 /*
  * initialize_idt
@@ -214,6 +240,9 @@ initialize_idt() {
             /* PIT */
             else if (i == PIC_IRQ_START + PIT_IRQ)
                 SET_IDT_ENTRY(idt[i], &pit_irq);
+            /* COM1 */
+            else if (i == PIC_IRQ_START + SERIAL_IRQ)
+                SET_IDT_ENTRY(idt[i], &serial_irq);
             /* unimplemented master PIC IRQs */
             else if (i <= PIC_IRQ_MASTER_END)
                 SET_IDT_ENTRY(idt[i], &pic_irq_master);
@@ -237,26 +266,26 @@ initialize_idt() {
     }
 
     /* Map all Intel exceptions in the IDT */
-    SET_IDT_ENTRY(idt[0],  &intel_divide_error);
-    SET_IDT_ENTRY(idt[1],  &intel_debug);
-    SET_IDT_ENTRY(idt[2],  &intel_nmi);
-    SET_IDT_ENTRY(idt[3],  &intel_int3);
-    SET_IDT_ENTRY(idt[4],  &intel_overflow);
-    SET_IDT_ENTRY(idt[5],  &intel_bounds);
-    SET_IDT_ENTRY(idt[6],  &intel_invalid_op);
-    SET_IDT_ENTRY(idt[7],  &intel_device_not_available);
-    SET_IDT_ENTRY(idt[8],  &intel_doublefault_fn);
-    SET_IDT_ENTRY(idt[9],  &intel_coprocessor_seg_overrun);
-    SET_IDT_ENTRY(idt[10], &intel_invalid_TSS);
-    SET_IDT_ENTRY(idt[11], &intel_seg_not_present);
-    SET_IDT_ENTRY(idt[12], &intel_stack_fault);
-    SET_IDT_ENTRY(idt[13], &intel_gpf);
-    SET_IDT_ENTRY(idt[14], &intel_page_fault);
+    SET_IDT_ENTRY(idt[0],  &divide_error_exception);
+    SET_IDT_ENTRY(idt[1],  &debug_exception);
+    SET_IDT_ENTRY(idt[2],  &nmi_exception);
+    SET_IDT_ENTRY(idt[3],  &int3_exception);
+    SET_IDT_ENTRY(idt[4],  &overflow_exception);
+    SET_IDT_ENTRY(idt[5],  &bounds_exception);
+    SET_IDT_ENTRY(idt[6],  &invalid_op_exception);
+    SET_IDT_ENTRY(idt[7],  &device_not_available_exception);
+    SET_IDT_ENTRY(idt[8],  &doublefault_exception);
+    SET_IDT_ENTRY(idt[9],  &coprocessor_seg_overrun_exception);
+    SET_IDT_ENTRY(idt[10], &invalid_TSS_exception);
+    SET_IDT_ENTRY(idt[11], &seg_not_present_exception);
+    SET_IDT_ENTRY(idt[12], &stack_fault_exception);
+    SET_IDT_ENTRY(idt[13], &gpf_exception);
+    SET_IDT_ENTRY(idt[14], &page_fault_exception);
     /* 15 is Intel reserved */
-    SET_IDT_ENTRY(idt[16], &intel_fpu_coprocessor_error);
-    SET_IDT_ENTRY(idt[17], &intel_alignment_check);
-    SET_IDT_ENTRY(idt[18], &intel_machine_check);
-    SET_IDT_ENTRY(idt[19], &intel_simd_coprocessor_error);
+    SET_IDT_ENTRY(idt[16], &fpu_coprocessor_error_exception);
+    SET_IDT_ENTRY(idt[17], &alignment_check_exception);
+    SET_IDT_ENTRY(idt[18], &machine_check_exception);
+    SET_IDT_ENTRY(idt[19], &simd_coprocessor_error_exception);
 }
 
 